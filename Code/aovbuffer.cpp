@@ -0,0 +1,29 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#include "aovbuffer.h"
+
+#include <cstddef>
+
+AovBuffer::AovBuffer( )
+    : w( 0 ), h( 0 ) {
+}
+
+void AovBuffer::resize( unsigned width, unsigned height ) {
+    w = width;
+    h = height;
+
+    size_t n = (size_t) width * height;
+    depths.resize( n );
+    normalX.resize( n );
+    normalY.resize( n );
+    normalZ.resize( n );
+    objectIds.resize( n );
+}
+
+unsigned AovBuffer::width( ) const {
+    return w;
+}
+
+unsigned AovBuffer::height( ) const {
+    return h;
+}
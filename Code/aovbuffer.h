@@ -0,0 +1,41 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef AOVBUFFER_H_
+#define AOVBUFFER_H_
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Arbitrary output variables (AOVs) of a render: the per-pixel data besides
+ * the color that a compositor needs, such as depth for fog or object ids for
+ * mattes.
+ *
+ * They are not filtered over the samples of a pixel, but taken from the
+ * sub-sample closest to its center. Pixels are in scanline order.
+ */
+class AovBuffer
+{
+    public:
+        // Object id of pixels that show no object
+        static uint32_t const NO_OBJECT = 0;
+
+        AovBuffer( );
+
+        void resize( unsigned width, unsigned height );
+
+        unsigned width( ) const;
+        unsigned height( ) const;
+
+        // Distance along the camera ray. Infinite if nothing is hit
+        std::vector< float > depths;
+        // Surface normal. Zero if nothing is hit
+        std::vector< float > normalX, normalY, normalZ;
+        // One more than the index of the object in the scene
+        std::vector< uint32_t > objectIds;
+
+    private:
+        unsigned w, h;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#include "exr.h"
+
+#include "aovbuffer.h"
+#include "image.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+// Pixel types of channels
+static int32_t const EXR_UINT = 0;
+static int32_t const EXR_FLOAT = 2;
+
+// A channel reads the value of pixel (x, y) as the 4 bytes of a float or uint32
+struct Channel
+{
+    char const *name;
+    int32_t type;
+    void ( *read )( Image const &img, AovBuffer const *aovs, unsigned x, unsigned y, char *dst );
+};
+
+template < class T >
+static void put( vector< char > &buffer, T const &value ) {
+    char const *bytes = (char const *) &value;
+    buffer.insert( buffer.end( ), bytes, bytes + sizeof( T ) );
+}
+
+static void putString( vector< char > &buffer, char const *str ) {
+    buffer.insert( buffer.end( ), str, str + strlen( str ) + 1 );
+}
+
+// Attribute header: name, type name and size of the value
+static void putAttribute( vector< char > &buffer, char const *name, char const *type, int32_t size ) {
+    putString( buffer, name );
+    putString( buffer, type );
+    put( buffer, size );
+}
+
+template < class T >
+static void copyValue( char *dst, T value ) {
+    memcpy( dst, &value, 4 );
+}
+
+static size_t aovIndex( AovBuffer const *aovs, unsigned x, unsigned y ) {
+    return (size_t) y * aovs->width( ) + x;
+}
+
+// Sorted by name, as the format requires
+static Channel const CHANNELS[] = {
+    { "B", EXR_FLOAT, []( Image const &img, AovBuffer const *, unsigned x, unsigned y, char *dst ) {
+        copyValue( dst, (float) img( x, y ).b ); } },
+    { "G", EXR_FLOAT, []( Image const &img, AovBuffer const *, unsigned x, unsigned y, char *dst ) {
+        copyValue( dst, (float) img( x, y ).g ); } },
+    { "N.X", EXR_FLOAT, []( Image const &, AovBuffer const *aovs, unsigned x, unsigned y, char *dst ) {
+        copyValue( dst, aovs->normalX[ aovIndex( aovs, x, y ) ] ); } },
+    { "N.Y", EXR_FLOAT, []( Image const &, AovBuffer const *aovs, unsigned x, unsigned y, char *dst ) {
+        copyValue( dst, aovs->normalY[ aovIndex( aovs, x, y ) ] ); } },
+    { "N.Z", EXR_FLOAT, []( Image const &, AovBuffer const *aovs, unsigned x, unsigned y, char *dst ) {
+        copyValue( dst, aovs->normalZ[ aovIndex( aovs, x, y ) ] ); } },
+    { "R", EXR_FLOAT, []( Image const &img, AovBuffer const *, unsigned x, unsigned y, char *dst ) {
+        copyValue( dst, (float) img( x, y ).r ); } },
+    { "Z", EXR_FLOAT, []( Image const &, AovBuffer const *aovs, unsigned x, unsigned y, char *dst ) {
+        copyValue( dst, aovs->depths[ aovIndex( aovs, x, y ) ] ); } },
+    { "id", EXR_UINT, []( Image const &, AovBuffer const *aovs, unsigned x, unsigned y, char *dst ) {
+        copyValue( dst, aovs->objectIds[ aovIndex( aovs, x, y ) ] ); } },
+};
+
+static bool isColorChannel( Channel const &channel ) {
+    return strlen( channel.name ) == 1 && strchr( "RGB", channel.name[ 0 ] ) != nullptr;
+}
+
+bool writeExr( string const &filename, Image const &img, AovBuffer const *aovs ) {
+    vector< Channel > channels;
+    for ( Channel const &channel : CHANNELS ) {
+        if ( aovs || isColorChannel( channel ) )
+            channels.push_back( channel );
+    }
+    int32_t w = img.width( );
+    int32_t h = img.height( );
+
+    // All values are little endian in the format, so this assumes a little
+    // endian machine (as the G-buffer dump does)
+    vector< char > header;
+    // Magic number and version 2 (single part scanline file, short names)
+    put( header, (uint32_t) 20000630 );
+    put( header, (uint32_t) 2 );
+
+    vector< char > channelList;
+    for ( Channel const &channel : channels ) {
+        putString( channelList, channel.name );
+        put( channelList, channel.type );
+        put( channelList, (uint32_t) 0 ); // Not perceptually linear, reserved
+        put( channelList, (int32_t) 1 );  // Sampling
+        put( channelList, (int32_t) 1 );
+    }
+    channelList.push_back( 0 );
+    putAttribute( header, "channels", "chlist", channelList.size( ) );
+    header.insert( header.end( ), channelList.begin( ), channelList.end( ) );
+
+    int32_t const window[] = { 0, 0, w - 1, h - 1 };
+    putAttribute( header, "compression", "compression", 1 );
+    header.push_back( 0 ); // None
+    putAttribute( header, "dataWindow", "box2i", sizeof window );
+    header.insert( header.end( ), (char const *) window, (char const *) window + sizeof window );
+    putAttribute( header, "displayWindow", "box2i", sizeof window );
+    header.insert( header.end( ), (char const *) window, (char const *) window + sizeof window );
+    putAttribute( header, "lineOrder", "lineOrder", 1 );
+    header.push_back( 0 ); // Increasing y
+    putAttribute( header, "pixelAspectRatio", "float", 4 );
+    put( header, 1.0f );
+    putAttribute( header, "screenWindowCenter", "v2f", 8 );
+    put( header, 0.0f );
+    put( header, 0.0f );
+    putAttribute( header, "screenWindowWidth", "float", 4 );
+    put( header, 1.0f );
+    header.push_back( 0 );
+
+    // Every scanline is a chunk of its own: its y, the size of its data, and
+    // then the data of all channels one after the other
+    int32_t lineBytes = w * 4 * channels.size( );
+    uint64_t chunkBytes = 8 + lineBytes;
+    uint64_t firstChunk = header.size( ) + (uint64_t) h * 8;
+    for ( int32_t y = 0; y < h; y++ )
+        put( header, firstChunk + y * chunkBytes );
+
+    ofstream file( filename, ios::binary );
+    file.write( header.data( ), header.size( ) );
+    vector< char > line( chunkBytes );
+    for ( int32_t y = 0; y < h; y++ ) {
+        memcpy( &line[ 0 ], &y, 4 );
+        memcpy( &line[ 4 ], &lineBytes, 4 );
+        char *dst = &line[ 8 ];
+        for ( Channel const &channel : channels ) {
+            for ( int32_t x = 0; x < w; x++, dst += 4 )
+                channel.read( img, aovs, x, y, dst );
+        }
+        file.write( line.data( ), line.size( ) );
+    }
+    return (bool) file;
+}
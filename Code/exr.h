@@ -0,0 +1,18 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef EXR_H_
+#define EXR_H_
+
+#include <string>
+
+class AovBuffer;
+class Image;
+
+// Writes an uncompressed scanline OpenEXR file with the (unclamped) colors
+// of 'img' as 32-bit float channels R, G and B. If 'aovs' is given, it has
+// the size of the image and its layers are added as channels N.X, N.Y, N.Z
+// (normal), Z (depth) and id (object id, 32-bit unsigned). Returns false if
+// the file could not be written
+bool writeExr( std::string const &filename, Image const &img, AovBuffer const *aovs );
+
+#endif
@@ -0,0 +1,91 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#include "framebuffer.h"
+
+#include "image.h"
+
+#include <algorithm>
+
+using namespace std;
+
+static unsigned const TILE_FLOATS = FrameBuffer::TILE_SIZE * FrameBuffer::TILE_SIZE * 4;
+
+FrameBuffer::FrameBuffer( )
+    : w( 0 ), h( 0 ), tilesX( 0 ), tilesY( 0 ), bandListener( nullptr ) {
+}
+
+void FrameBuffer::resize( unsigned width, unsigned height ) {
+    w = width;
+    h = height;
+    tilesX = ( width + TILE_SIZE - 1 ) / TILE_SIZE;
+    tilesY = ( height + TILE_SIZE - 1 ) / TILE_SIZE;
+    data.assign( (size_t) numTiles( ) * TILE_FLOATS, 0.0f );
+    bandCommits = vector< atomic< unsigned > >( tilesY );
+    for ( atomic< unsigned > &commits : bandCommits )
+        commits = 0;
+}
+
+void FrameBuffer::clear( ) {
+    fill( data.begin( ), data.end( ), 0.0f );
+    for ( atomic< unsigned > &commits : bandCommits )
+        commits = 0;
+}
+
+void FrameBuffer::setBandListener( BandListener *listener ) {
+    bandListener = listener;
+}
+
+unsigned FrameBuffer::width( ) const {
+    return w;
+}
+
+unsigned FrameBuffer::height( ) const {
+    return h;
+}
+
+unsigned FrameBuffer::numTiles( ) const {
+    return tilesX * tilesY;
+}
+
+void FrameBuffer::beginTile( unsigned index, TileBuffer &tile ) const {
+    tile.index = index;
+    tile.tileX0 = ( index % tilesX ) * TILE_SIZE;
+    tile.tileY0 = ( index / tilesX ) * TILE_SIZE;
+    tile.tileX1 = min( tile.tileX0 + TILE_SIZE, w );
+    tile.tileY1 = min( tile.tileY0 + TILE_SIZE, h );
+    fill( tile.data, tile.data + TILE_FLOATS, 0.0 );
+}
+
+void FrameBuffer::commit( TileBuffer const &tile ) {
+    float *dst = &data[ (size_t) tile.index * TILE_FLOATS ];
+    for ( unsigned i = 0; i < TILE_FLOATS; i++ )
+        dst[ i ] += (float) tile.data[ i ];
+
+    unsigned band = tile.index / tilesX;
+    if ( ++bandCommits[ band ] == tilesX && bandListener )
+        bandListener->bandDone( *this, tile.tileY0, tile.tileY1 );
+}
+
+float const *FrameBuffer::pixel( unsigned x, unsigned y ) const {
+    size_t tile = ( y / TILE_SIZE ) * tilesX + x / TILE_SIZE;
+    return &data[ tile * TILE_FLOATS + ( ( y % TILE_SIZE ) * TILE_SIZE + x % TILE_SIZE ) * 4 ];
+}
+
+Color FrameBuffer::color( unsigned x, unsigned y ) const {
+    float const *p = pixel( x, y );
+    if ( p[ 3 ] <= 0 )
+        return Color( 0.0, 0.0, 0.0 );
+    return Color( p[ 0 ], p[ 1 ], p[ 2 ] ) / p[ 3 ];
+}
+
+float FrameBuffer::weight( unsigned x, unsigned y ) const {
+    return pixel( x, y )[ 3 ];
+}
+
+void FrameBuffer::toImage( Image &img ) const {
+    #pragma omp parallel for
+    for ( unsigned y = 0; y < h; y++ ) {
+        for ( unsigned x = 0; x < w; x++ )
+            img( x, y ) = color( x, y );
+    }
+}
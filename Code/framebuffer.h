@@ -0,0 +1,108 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef FRAMEBUFFER_H_
+#define FRAMEBUFFER_H_
+
+#include "triple.h"
+
+#include <atomic>
+#include <vector>
+
+class Image;
+
+/**
+ * Render target that accumulates weighted samples per pixel.
+ *
+ * Every pixel holds four floats: the weighted sum of its sample colors (RGB)
+ * and the sum of their weights. Its color is their ratio, so more samples can
+ * be added to any pixel at any time (progressive or adaptive sampling).
+ *
+ * The image is stored tile after tile (in scanline order of the tiles), each
+ * tile being TILE_SIZE x TILE_SIZE contiguous pixels. Tiles on the right and
+ * bottom edges are padded. Threads accumulate a tile in a TileBuffer of their
+ * own and commit it at once. Only Image conversion is in scanline order.
+ */
+class FrameBuffer
+{
+    public:
+        static unsigned const TILE_SIZE = 16;
+
+        // The samples of a single tile, before they are committed
+        class TileBuffer
+        {
+            public:
+                unsigned x0( ) const { return tileX0; }
+                unsigned y0( ) const { return tileY0; }
+                // Bounds of the tile within the image (exclusive)
+                unsigned x1( ) const { return tileX1; }
+                unsigned y1( ) const { return tileY1; }
+
+                // (x,y) is a pixel of the image within this tile. Not checked
+                void add( unsigned x, unsigned y, Color const &color, float weight = 1.0f )
+                {
+                    double *p = &data[ ( ( y - tileY0 ) * TILE_SIZE + ( x - tileX0 ) ) * 4 ];
+                    p[ 0 ] += weight * color.r;
+                    p[ 1 ] += weight * color.g;
+                    p[ 2 ] += weight * color.b;
+                    p[ 3 ] += weight;
+                }
+
+            private:
+                friend class FrameBuffer;
+
+                unsigned index;
+                unsigned tileX0, tileY0, tileX1, tileY1;
+                // Summed in double, as rounding every sample to float shows in
+                // supersampled pixels. Rounded once when committed
+                double data[ TILE_SIZE * TILE_SIZE * 4 ];
+        };
+
+        // Is told when bands of rows are complete, e.g. to stream them out
+        class BandListener
+        {
+            public:
+                virtual ~BandListener( ) { }
+
+                // Every tile of rows [y0, y1) has been committed. Called by the
+                // thread that committed the last of them, so bands may complete
+                // concurrently and in any order
+                virtual void bandDone( FrameBuffer const &frameBuffer, unsigned y0, unsigned y1 ) = 0;
+        };
+
+        FrameBuffer( );
+
+        // Resizes to 'width' x 'height' pixels without any samples
+        void resize( unsigned width, unsigned height );
+        void clear( );
+        // Null for none. Every band of TILE_SIZE rows (the last may be shorter)
+        // is reported once after a resize or clear, when its tiles are committed
+        void setBandListener( BandListener *listener );
+
+        unsigned width( ) const;
+        unsigned height( ) const;
+        unsigned numTiles( ) const;
+
+        // Prepares an empty buffer for tile 'index'
+        void beginTile( unsigned index, TileBuffer &tile ) const;
+        // Adds the samples of the tile. Distinct tiles may be committed concurrently
+        void commit( TileBuffer const &tile );
+
+        // Weighted average of the samples of the pixel. Black if it has none
+        Color color( unsigned x, unsigned y ) const;
+        float weight( unsigned x, unsigned y ) const;
+
+        // Writes the color of every pixel into 'img', which must be as large
+        void toImage( Image &img ) const;
+
+    private:
+        unsigned w, h;
+        unsigned tilesX, tilesY;
+        std::vector< float > data;
+        BandListener *bandListener;
+        // Number of committed tiles per band
+        std::vector< std::atomic< unsigned > > bandCommits;
+
+        float const *pixel( unsigned x, unsigned y ) const;
+};
+
+#endif
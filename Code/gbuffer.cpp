@@ -0,0 +1,79 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#include "gbuffer.h"
+
+#include <fstream>
+
+using namespace std;
+
+static uint32_t const VERSION = 1;
+
+template < class T >
+static void writeArray( ostream &os, vector< T > const &values ) {
+    os.write( (char const *) values.data( ), values.size( ) * sizeof( T ) );
+}
+
+GBuffer::GBuffer( )
+    : w( 0 ), h( 0 ), spp( 0 ) {
+}
+
+void GBuffer::resize( unsigned width, unsigned height, unsigned samplesPerPixel ) {
+    w = width;
+    h = height;
+    spp = samplesPerPixel;
+
+    size_t n = size( );
+    objectIds.resize( n );
+    materialIds.resize( n );
+    depths.resize( n );
+    normalX.resize( n );
+    normalY.resize( n );
+    normalZ.resize( n );
+    u.resize( n );
+    v.resize( n );
+}
+
+unsigned GBuffer::width( ) const {
+    return w;
+}
+
+unsigned GBuffer::height( ) const {
+    return h;
+}
+
+unsigned GBuffer::samplesPerPixel( ) const {
+    return spp;
+}
+
+size_t GBuffer::size( ) const {
+    return (size_t) w * h * spp;
+}
+
+Vector GBuffer::normal( size_t sample ) const {
+    return Vector( normalX[ sample ], normalY[ sample ], normalZ[ sample ] );
+}
+
+void GBuffer::setNormal( size_t sample, Vector const &N ) {
+    normalX[ sample ] = (float) N.x;
+    normalY[ sample ] = (float) N.y;
+    normalZ[ sample ] = (float) N.z;
+}
+
+bool GBuffer::write( string const &filename ) const {
+    ofstream file( filename, ios::binary );
+    if ( !file )
+        return false;
+
+    uint32_t header[] = { VERSION, w, h, spp };
+    file.write( "RTGB", 4 );
+    file.write( (char const *) header, sizeof header );
+    writeArray( file, objectIds );
+    writeArray( file, materialIds );
+    writeArray( file, depths );
+    writeArray( file, normalX );
+    writeArray( file, normalY );
+    writeArray( file, normalZ );
+    writeArray( file, u );
+    writeArray( file, v );
+    return (bool) file;
+}
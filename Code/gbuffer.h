@@ -0,0 +1,58 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef GBUFFER_H_
+#define GBUFFER_H_
+
+#include "material.h"
+#include "triple.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Per-sample hit data of the primary rays, as produced by the visibility pass
+ * of deferred shading.
+ *
+ * Every attribute is stored in its own array (structure of arrays), indexed
+ * by sample. Samples are ordered by pixel in scanline order, and within a
+ * pixel by sub-sample in scanline order. Samples that hit nothing have object
+ * id NO_OBJECT, and all their other attributes are undefined.
+ */
+class GBuffer
+{
+    public:
+        static uint32_t const NO_OBJECT = ~0u;
+
+        GBuffer( );
+
+        // Resizes all attributes. Their contents are undefined afterwards
+        void resize( unsigned width, unsigned height, unsigned samplesPerPixel );
+
+        unsigned width( ) const;
+        unsigned height( ) const;
+        unsigned samplesPerPixel( ) const;
+        size_t size( ) const;
+
+        // Index of the object in the scene
+        std::vector< uint32_t > objectIds;
+        std::vector< MaterialId > materialIds;
+        // Distance along the (normalized) camera ray
+        std::vector< double > depths;
+        std::vector< float > normalX, normalY, normalZ;
+        std::vector< float > u, v;
+
+        Vector normal( size_t sample ) const;
+        void setNormal( size_t sample, Vector const &N );
+
+        // Writes the buffer for use by other tools. The file starts with the
+        // magic "RTGB", followed by the uint32 version, width, height and
+        // samples per pixel. Then the attributes follow, each as a full array
+        // in the order they are declared above, in native byte order
+        bool write( std::string const &filename ) const;
+
+    private:
+        unsigned w, h, spp;
+};
+
+#endif
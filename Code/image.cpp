@@ -1,6 +1,10 @@
 #include "image.h"
 
 #include "lode/lodepng.h"
+#include <zlib.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 
@@ -62,19 +66,208 @@ Color const &Image::colorAt(float x, float y) const
     return d_pixels.at(findex(x, y));
 }
 
-void Image::write_png(std::string const &filename) const
+// lodepng is compiled without its bytewise CRC (see CMakeLists.txt), as the
+// one of zlib is a lot faster
+unsigned lodepng_crc32(unsigned char const *data, size_t length)
 {
-    vector<unsigned char> image;
-    image.reserve(size() * 4);  // reserves size (less allocations)
-    for (Color pixel : d_pixels)
+    return crc32(crc32(0, nullptr, 0), data, length);
+}
+
+// PNG filter of a byte, given the bytes left (a), up (b) and up-left (c)
+static unsigned char filterByte(unsigned char type, int x, int a, int b, int c)
+{
+    switch (type)
+    {
+        case 1: return x - a;
+        case 2: return x - b;
+        case 3: return x - (a + b) / 2;
+        case 4:
+        {
+            // Paeth predictor
+            int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+            return x - (pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+        }
+        default: return x;
+    }
+}
+
+// Chooses the filter of every row of an RGB image, picking the one with the
+// smallest sum of absolute (signed) filtered bytes. This is the heuristic
+// lodepng uses by default, but then with all rows in parallel
+static vector<unsigned char> chooseFilters(vector<unsigned char> const &rgb,
+                                           unsigned width, unsigned height)
+{
+    size_t const rowBytes = width * 3;
+    vector<unsigned char> filters(height);
+    #pragma omp parallel for
+    for (unsigned y = 0; y < height; ++y)
+    {
+        unsigned char const *row = &rgb[y * rowBytes];
+        unsigned char const *prev = y > 0 ? row - rowBytes : nullptr;
+        size_t bestSum = SIZE_MAX;
+        for (unsigned char type = 0; type < 5; ++type)
+        {
+            size_t sum = 0;
+            for (size_t i = 0; i < rowBytes; ++i)
+            {
+                int a = i >= 3 ? row[i - 3] : 0;
+                int b = prev ? prev[i] : 0;
+                int c = prev && i >= 3 ? prev[i - 3] : 0;
+                unsigned char f = filterByte(type, row[i], a, b, c);
+                sum += type == 0 ? f : abs(static_cast<signed char>(f));
+            }
+            if (sum < bestSum)
+            {
+                bestSum = sum;
+                filters[y] = type;
+            }
+        }
+    }
+    return filters;
+}
+
+// Size of the pieces of PNG data that are deflated independently
+static size_t const DEFLATE_CHUNK = 128 * 1024;
+// History each chunk is primed with, so chunking barely costs compression
+static size_t const DEFLATE_WINDOW = 32 * 1024;
+
+// Replaces the zlib compressor of lodepng. The (filtered) image data is split
+// in chunks, which are deflated in parallel with a full flush each, such that
+// their raw deflate streams can simply be concatenated. The Adler-32 checksums
+// of the chunks are combined after.
+static unsigned parallelZlib(unsigned char **out, size_t *outsize,
+                             unsigned char const *in, size_t insize,
+                             LodePNGCompressSettings const *settings)
+{
+    int level = *static_cast<int const *>(settings->custom_context);
+    int numChunks = static_cast<int>(max((insize + DEFLATE_CHUNK - 1) / DEFLATE_CHUNK, size_t(1)));
+    vector<vector<unsigned char>> chunks(numChunks);
+    vector<uLong> adlers(numChunks);
+    bool failed = false;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < numChunks; ++i)
+    {
+        size_t start = i * DEFLATE_CHUNK;
+        size_t length = min(DEFLATE_CHUNK, insize - start);
+        bool last = (i == numChunks - 1);
+
+        z_stream stream = z_stream();
+        if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            failed = true;
+            continue;
+        }
+        if (start > 0 && level > 0)
+        {
+            size_t window = min(start, DEFLATE_WINDOW);
+            deflateSetDictionary(&stream, in + start - window, window);
+        }
+
+        vector<unsigned char> &chunk = chunks[i];
+        chunk.resize(deflateBound(&stream, length) + 16);   // + flush marker
+        stream.next_in = const_cast<unsigned char *>(in + start);
+        stream.avail_in = length;
+        stream.next_out = chunk.data();
+        stream.avail_out = chunk.size();
+        int result = deflate(&stream, last ? Z_FINISH : Z_FULL_FLUSH);
+        if (result != (last ? Z_STREAM_END : Z_OK) || stream.avail_in != 0)
+            failed = true;
+        chunk.resize(stream.total_out);
+        deflateEnd(&stream);
+
+        adlers[i] = adler32(adler32(0, nullptr, 0), in + start, length);
+    }
+    if (failed)
+        return 111;     // not a lodepng error code
+
+    // zlib header (deflate, 32K window, level hint) and stream
+    unsigned char cmf = 0x78;
+    unsigned char flg = (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6;
+    flg += 31 - (cmf * 256 + flg) % 31;
+    vector<unsigned char> zlib = { cmf, flg };
+    uLong adler = adlers[0];
+    for (int i = 0; i < numChunks; ++i)
+    {
+        zlib.insert(zlib.end(), chunks[i].begin(), chunks[i].end());
+        if (i > 0)
+            adler = adler32_combine(adler, adlers[i], min(DEFLATE_CHUNK, insize - i * DEFLATE_CHUNK));
+    }
+    for (int shift = 24; shift >= 0; shift -= 8)
+        zlib.push_back((adler >> shift) & 0xFF);
+
+    // lodepng frees the output with free()
+    *out = static_cast<unsigned char *>(malloc(zlib.size()));
+    if (*out == nullptr)
+        return 83;
+    copy(zlib.begin(), zlib.end(), *out);
+    *outsize = zlib.size();
+    return 0;
+}
+
+void Image::write_png(std::string const &filename, int compressionLevel) const
+{
+    // Alpha is always 1, so it is not stored. Quantization is per pixel, so
+    // rows are converted in parallel
+    vector<unsigned char> image(size() * 3);
+    #pragma omp parallel for
+    for (unsigned y = 0; y < d_height; ++y)
     {
-        image.push_back(static_cast<unsigned char>(pixel.r * 255.0));
-        image.push_back(static_cast<unsigned char>(pixel.g * 255.0));
-        image.push_back(static_cast<unsigned char>(pixel.b * 255.0));
-        image.push_back(255);   // alpha is always 1
+        for (unsigned x = 0; x < d_width; ++x)
+        {
+            Color const &pixel = d_pixels[index(x, y)];
+            unsigned char *rgb = &image[index(x, y) * 3];
+            rgb[0] = static_cast<unsigned char>(pixel.r * 255.0);
+            rgb[1] = static_cast<unsigned char>(pixel.g * 255.0);
+            rgb[2] = static_cast<unsigned char>(pixel.b * 255.0);
+        }
     }
 
-    lodepng::encode(filename, image, d_width, d_height);
+    int level = min(max(compressionLevel, 0), 9);
+    lodepng::State state;
+    state.info_raw.colortype = LCT_RGB;
+    state.info_png.color.colortype = LCT_RGB;
+    state.encoder.auto_convert = 0;     // scanning for a palette is slow
+    // Filtering only pays off when compressing
+    vector<unsigned char> filters;
+    if (level == 0)
+        state.encoder.filter_strategy = LFS_ZERO;
+    else
+    {
+        filters = chooseFilters(image, d_width, d_height);
+        state.encoder.filter_strategy = LFS_PREDEFINED;
+        state.encoder.predefined_filters = filters.data();
+    }
+    state.encoder.zlibsettings.custom_zlib = parallelZlib;
+    state.encoder.zlibsettings.custom_context = &level;
+
+    vector<unsigned char> png;
+    unsigned error = lodepng::encode(png, image, d_width, d_height, state);
+    if (!error)
+        error = lodepng::save_file(png, filename);
+    if (error)
+        cerr << "Error: writing " << filename << " failed: "
+             << (error == 111 ? "compression failed" : lodepng_error_text(error)) << '\n';
+}
+
+bool Image::write_pfm(std::string const &filename) const
+{
+    ofstream file(filename, ios::binary);
+    // A negative scale marks little endian data. Rows go from bottom to top
+    file << "PF\n" << d_width << ' ' << d_height << "\n-1.0\n";
+    vector<float> row(d_width * 3);
+    for (unsigned y = d_height; y-- > 0; )
+    {
+        for (unsigned x = 0; x < d_width; ++x)
+        {
+            Color const &pixel = d_pixels[index(x, y)];
+            row[3 * x] = static_cast<float>(pixel.r);
+            row[3 * x + 1] = static_cast<float>(pixel.g);
+            row[3 * x + 2] = static_cast<float>(pixel.b);
+        }
+        file.write(reinterpret_cast<char const *>(row.data()), row.size() * sizeof(float));
+    }
+    return static_cast<bool>(file);
 }
 
 void Image::read_png(std::string const &filename)
@@ -34,8 +34,14 @@ class Image
         // usefull for texture access
         Color const &colorAt(float x, float y) const;
 
-        void write_png(std::string const &filename) const;
+        // Compression levels are those of zlib: 0 (store, fastest) to 9 (smallest)
+        static int const DEFAULT_PNG_COMPRESSION = 6;
+        void write_png(std::string const &filename,
+                       int compressionLevel = DEFAULT_PNG_COMPRESSION) const;
         void read_png(std::string const &filename);
+        // Portable float map: unclamped 32-bit float RGB. Returns false if the
+        // file could not be written
+        bool write_pfm(std::string const &filename) const;
 
     private:
         inline unsigned index(unsigned x, unsigned y) const
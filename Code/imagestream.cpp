@@ -0,0 +1,109 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#include "imagestream.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+ImageStream::ImageStream( )
+    : file( nullptr ), fileFormat( PPM ), failed( false ), nextBand( 0 ) {
+}
+
+ImageStream::~ImageStream( ) {
+    if ( file && file != stdout )
+        fclose( file );
+}
+
+bool ImageStream::open( string const &filename, Format format ) {
+    file = filename == "-" ? stdout : fopen( filename.c_str( ), "wb" );
+    fileFormat = format;
+    return file != nullptr;
+}
+
+bool ImageStream::isOpen( ) const {
+    return file != nullptr;
+}
+
+ImageStream::Format ImageStream::format( ) const {
+    return fileFormat;
+}
+
+void ImageStream::beginFrame( FrameBuffer &frameBuffer ) {
+    unsigned w = frameBuffer.width( );
+    unsigned h = frameBuffer.height( );
+    if ( fileFormat == PPM ) {
+        fprintf( file, "P6\n%u %u\n255\n", w, h );
+    } else {
+        uint32_t header[] = { w, h, 3 };
+        fwrite( "RTFR", 1, 4, file );
+        fwrite( header, sizeof header, 1, file );
+    }
+    fflush( file );
+
+    failed = false;
+    bandsDone.assign( ( h + FrameBuffer::TILE_SIZE - 1 ) / FrameBuffer::TILE_SIZE, false );
+    nextBand = 0;
+    frameBuffer.setBandListener( this );
+}
+
+void ImageStream::bandDone( FrameBuffer const &frameBuffer, unsigned y0, unsigned y1 ) {
+    lock_guard< std::mutex > lock( mutex );
+    bandsDone[ y0 / FrameBuffer::TILE_SIZE ] = true;
+    bool wrote = false;
+    while ( nextBand < bandsDone.size( ) && bandsDone[ nextBand ] ) {
+        unsigned bandY0 = nextBand * FrameBuffer::TILE_SIZE;
+        writeBand( frameBuffer, bandY0, min( bandY0 + FrameBuffer::TILE_SIZE, frameBuffer.height( ) ) );
+        nextBand++;
+        wrote = true;
+    }
+    if ( wrote )
+        fflush( file );
+}
+
+void ImageStream::endFrame( FrameBuffer &frameBuffer ) {
+    frameBuffer.setBandListener( nullptr );
+    if ( nextBand != bandsDone.size( ) )
+        failed = true;
+    fflush( file );
+}
+
+bool ImageStream::good( ) const {
+    return !failed && !ferror( file );
+}
+
+void ImageStream::writeBand( FrameBuffer const &frameBuffer, unsigned y0, unsigned y1 ) {
+    unsigned w = frameBuffer.width( );
+    size_t numPixels = (size_t) w * ( y1 - y0 );
+    if ( fileFormat == PPM ) {
+        buffer.resize( numPixels * 3 );
+        unsigned char *dst = buffer.data( );
+        for ( unsigned y = y0; y < y1; y++ ) {
+            for ( unsigned x = 0; x < w; x++ ) {
+                // Quantized as by Image::write_png
+                Color col = frameBuffer.color( x, y );
+                col.clamp( );
+                *dst++ = static_cast< unsigned char >( col.r * 255.0 );
+                *dst++ = static_cast< unsigned char >( col.g * 255.0 );
+                *dst++ = static_cast< unsigned char >( col.b * 255.0 );
+            }
+        }
+    } else {
+        uint32_t header[] = { y0, y1 - y0 };
+        buffer.resize( sizeof header + numPixels * 3 * sizeof( float ) );
+        memcpy( buffer.data( ), header, sizeof header );
+        float *dst = (float *) ( buffer.data( ) + sizeof header );
+        for ( unsigned y = y0; y < y1; y++ ) {
+            for ( unsigned x = 0; x < w; x++ ) {
+                Color col = frameBuffer.color( x, y );
+                *dst++ = (float) col.r;
+                *dst++ = (float) col.g;
+                *dst++ = (float) col.b;
+            }
+        }
+    }
+    if ( fwrite( buffer.data( ), 1, buffer.size( ), file ) != buffer.size( ) )
+        failed = true;
+}
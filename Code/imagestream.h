@@ -0,0 +1,62 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef IMAGESTREAM_H_
+#define IMAGESTREAM_H_
+
+#include "framebuffer.h"
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Writes the rows of frames to a file, pipe or stdout while they are being
+ * rendered, for viewers and encoders that consume frames as they come in.
+ *
+ * Bands of rows complete in any order, so they wait in a reorder buffer (of
+ * one flag per band, the pixels stay in the frame buffer) until all bands
+ * above them are written. Frames simply follow each other. Formats:
+ *  PPM - Binary 8-bit PPM (P6). Colors are clamped
+ *  RAW - Per frame the magic "RTFR" and the uint32 width, height and number
+ *        of channels (3). Then packets of rows in order: the uint32 first row
+ *        and number of rows, followed by their float RGB pixels. All is
+ *        little endian (native)
+ */
+class ImageStream : public FrameBuffer::BandListener
+{
+    public:
+        enum Format { PPM, RAW };
+
+        ImageStream( );
+        ~ImageStream( );
+
+        // Opens the file or named pipe, or stdout for "-". Returns false if it
+        // cannot be opened
+        bool open( std::string const &filename, Format format );
+        bool isOpen( ) const;
+        Format format( ) const;
+
+        // Writes the header of a frame of the size of 'frameBuffer', and
+        // listens to it until endFrame
+        void beginFrame( FrameBuffer &frameBuffer );
+        void bandDone( FrameBuffer const &frameBuffer, unsigned y0, unsigned y1 ) override;
+        void endFrame( FrameBuffer &frameBuffer );
+        // False if the last frame was not written completely
+        bool good( ) const;
+
+    private:
+        FILE *file;
+        Format fileFormat;
+        bool failed;
+
+        std::mutex mutex;
+        std::vector< bool > bandsDone;
+        unsigned nextBand;
+        // Space for the pixels of a band
+        std::vector< unsigned char > buffer;
+
+        void writeBand( FrameBuffer const &frameBuffer, unsigned y0, unsigned y1 );
+};
+
+#endif
@@ -3,6 +3,9 @@
 
 #include "triple.h"
 
+#include <cmath>
+#include <limits>
+
 // Declare LightPtr for use in Scene class
 #include <memory>
 class Light;
@@ -11,13 +14,105 @@ typedef std::shared_ptr<Light> LightPtr;
 class Light
 {
     public:
+        enum Shape
+        {
+            POINT,
+            RECTANGLE,  // Centered at 'position', spanned by 'edge1' and 'edge2'
+            SPHERE      // Centered at 'position', with radius 'radius'
+        };
+
         Point const position;
         Color const color;
+        // Distance beyond which the light has no effect. Infinite for lights
+        // that reach the entire scene (without any falloff)
+        double const range;
+
+        Shape const shape;
+        Vector const edge1;
+        Vector const edge2;
+        double const radius;
+        // Maximum number of shadow rays per shaded point (area lights only)
+        unsigned const maxSamples;
+
+        Light(Point const &pos, Color const &c, double range = std::numeric_limits<double>::infinity())
+        :
+            Light(POINT, pos, c, range, Vector(), Vector(), 0, 1)
+        {}
+
+        static Light rectangle(Point const &center, Vector const &edge1, Vector const &edge2, Color const &c,
+                               unsigned maxSamples, double range = std::numeric_limits<double>::infinity())
+        {
+            return Light(RECTANGLE, center, c, range, edge1, edge2, 0, maxSamples);
+        }
+
+        static Light sphere(Point const &center, double radius, Color const &c,
+                            unsigned maxSamples, double range = std::numeric_limits<double>::infinity())
+        {
+            return Light(SPHERE, center, c, range, Vector(), Vector(), radius, maxSamples);
+        }
+
+        bool isArea() const
+        {
+            return shape != POINT;
+        }
+
+        bool isBounded() const
+        {
+            return !std::isinf(range);
+        }
+
+        // True if both lights cast the same shadows and falloff. They may
+        // differ in color only
+        bool sameGeometry(Light const &other) const
+        {
+            return shape == other.shape && position == other.position && range == other.range &&
+                   edge1 == other.edge1 && edge2 == other.edge2 && radius == other.radius &&
+                   maxSamples == other.maxSamples;
+        }
+
+        // Factor (0...1) by which the light is scaled at the given distance.
+        // Bounded lights fade out smoothly towards their range
+        double attenuation(double distance) const
+        {
+            if (!isBounded())
+                return 1.0;
+            if (distance >= range)
+                return 0.0;
+            double x = 1.0 - (distance * distance) / (range * range);
+            return x * x;
+        }
+
+        // Maps (u,v) in [0,1)^2 uniformly to a point of the light as seen from
+        // 'from'. A sphere is seen as the disc facing 'from'
+        Point samplePoint(double u, double v, Point const &from) const
+        {
+            if (shape == RECTANGLE)
+                return position + (u - 0.5) * edge1 + (v - 0.5) * edge2;
+            if (shape == POINT)
+                return position;
+
+            // Disc of the sphere perpendicular to the direction towards 'from'
+            Vector axis = (from - position).normalized();
+            Vector helper = std::fabs(axis.x) < 0.9 ? Vector(1, 0, 0) : Vector(0, 1, 0);
+            Vector tangent = axis.cross(helper).normalized();
+            Vector bitangent = axis.cross(tangent);
+            double r = radius * std::sqrt(u);
+            double phi = 2 * M_PI * v;
+            return position + r * std::cos(phi) * tangent + r * std::sin(phi) * bitangent;
+        }
 
-        Light(Point const &pos, Color const &c)
+    private:
+        Light(Shape shape, Point const &pos, Color const &c, double range,
+              Vector const &edge1, Vector const &edge2, double radius, unsigned maxSamples)
         :
             position(pos),
-            color(c)
+            color(c),
+            range(range),
+            shape(shape),
+            edge1(edge1),
+            edge2(edge2),
+            radius(radius),
+            maxSamples(maxSamples)
         {}
 };
 
@@ -0,0 +1,125 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#include "lightgrid.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+LightGrid::LightGrid( )
+    : resolution{ 0, 0, 0 } {
+}
+
+void LightGrid::build( vector< LightPtr > const &lights ) {
+    unbounded.clear( );
+    cellStart.clear( );
+    cellLights.clear( );
+
+    // Bounds of all spheres of influence
+    vector< unsigned > bounded;
+    Point upp;
+    for ( unsigned i = 0; i < lights.size( ); i++ ) {
+        Light const &light = *lights[ i ];
+        if ( !light.isBounded( ) ) {
+            unbounded.push_back( i );
+            continue;
+        }
+
+        Point lightLow = light.position - light.range;
+        Point lightUpp = light.position + light.range;
+        if ( bounded.empty( ) ) {
+            low = lightLow;
+            upp = lightUpp;
+        }
+        for ( int axis = 0; axis < 3; axis++ ) {
+            low.data[ axis ] = min( low.data[ axis ], lightLow.data[ axis ] );
+            upp.data[ axis ] = max( upp.data[ axis ], lightUpp.data[ axis ] );
+        }
+        bounded.push_back( i );
+    }
+
+    if ( bounded.empty( ) ) {
+        resolution[ 0 ] = resolution[ 1 ] = resolution[ 2 ] = 0;
+        return;
+    }
+
+    // Aim for about eight cells per light (twice the cube root of the number
+    // of lights along the longest axis), with cubic cells
+    Vector extent = upp - low;
+    double maxExtent = max( max( extent.x, extent.y ), extent.z );
+    double cellsAlongMax = min( (double) MAX_RESOLUTION, ceil( cbrt( (double) bounded.size( ) ) ) * 2 );
+    for ( int axis = 0; axis < 3; axis++ ) {
+        // Without extent (all lights have range 0) there is a single cell
+        resolution[ axis ] = 1;
+        if ( maxExtent > 0 )
+            resolution[ axis ] = max( 1u, (unsigned) ceil( extent.data[ axis ] / maxExtent * cellsAlongMax ) );
+        cellSize.data[ axis ] = extent.data[ axis ] / resolution[ axis ];
+    }
+
+    // Insert every light into all cells its bounding box overlaps. First count
+    // the lights per cell, then fill them
+    unsigned numCells = resolution[ 0 ] * resolution[ 1 ] * resolution[ 2 ];
+    vector< unsigned > counts( numCells + 1, 0 );
+    for ( int pass = 0; pass < 2; pass++ ) {
+        for ( unsigned idx : bounded ) {
+            Light const &light = *lights[ idx ];
+            int from[3], to[3];
+            for ( int axis = 0; axis < 3; axis++ ) {
+                from[ axis ] = max( 0, cellCoord( light.position.data[ axis ] - light.range, axis ) );
+                to[ axis ] = min( (int) resolution[ axis ] - 1, cellCoord( light.position.data[ axis ] + light.range, axis ) );
+            }
+            for ( int z = from[ 2 ]; z <= to[ 2 ]; z++ ) {
+                for ( int y = from[ 1 ]; y <= to[ 1 ]; y++ ) {
+                    for ( int x = from[ 0 ]; x <= to[ 0 ]; x++ ) {
+                        unsigned cell = cellIndex( x, y, z );
+                        if ( pass == 0 )
+                            counts[ cell ]++;
+                        else
+                            cellLights[ cellStart[ cell ] + counts[ cell ]++ ] = idx;
+                    }
+                }
+            }
+        }
+
+        if ( pass == 0 ) {
+            cellStart.assign( numCells + 1, 0 );
+            for ( unsigned cell = 0; cell < numCells; cell++ )
+                cellStart[ cell + 1 ] = cellStart[ cell ] + counts[ cell ];
+            cellLights.resize( cellStart[ numCells ] );
+            fill( counts.begin( ), counts.end( ), 0 );
+        }
+    }
+}
+
+vector< unsigned > const &LightGrid::unboundedLights( ) const {
+    return unbounded;
+}
+
+void LightGrid::query( Point const &p, unsigned const *&begin, unsigned const *&end ) const {
+    begin = end = nullptr;
+    if ( cellStart.empty( ) )
+        return;
+
+    int c[3];
+    for ( int axis = 0; axis < 3; axis++ ) {
+        c[ axis ] = cellCoord( p.data[ axis ], axis );
+        // Outside the grid the point is in no sphere of influence at all
+        if ( c[ axis ] < 0 || c[ axis ] >= (int) resolution[ axis ] )
+            return;
+    }
+
+    unsigned cell = cellIndex( c[ 0 ], c[ 1 ], c[ 2 ] );
+    begin = cellLights.data( ) + cellStart[ cell ];
+    end = cellLights.data( ) + cellStart[ cell + 1 ];
+}
+
+int LightGrid::cellCoord( double v, int axis ) const {
+    if ( cellSize.data[ axis ] <= 0 )
+        return 0;
+    return (int) floor( ( v - low.data[ axis ] ) / cellSize.data[ axis ] );
+}
+
+unsigned LightGrid::cellIndex( unsigned x, unsigned y, unsigned z ) const {
+    return ( z * resolution[ 1 ] + y ) * resolution[ 0 ] + x;
+}
@@ -0,0 +1,50 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef LIGHTGRID_H_
+#define LIGHTGRID_H_
+
+#include "light.h"
+#include "triple.h"
+
+#include <vector>
+
+/**
+ * Uniform grid over the spheres of influence of all bounded lights.
+ *
+ * Each cell lists the lights whose range overlaps it, so only those have to
+ * be considered for a point inside the cell. Unbounded lights (which reach
+ * everything) are kept in a separate list.
+ */
+class LightGrid
+{
+    public:
+        LightGrid( );
+
+        void build( std::vector< LightPtr > const &lights );
+
+        // Indices of the lights without a range
+        std::vector< unsigned > const &unboundedLights( ) const;
+
+        // Sets [begin,end) to the indices of bounded lights that may reach 'p'
+        void query( Point const &p, unsigned const *&begin, unsigned const *&end ) const;
+
+    private:
+        // Upper limit of cells along any axis
+        static unsigned const MAX_RESOLUTION = 64;
+
+        std::vector< unsigned > unbounded;
+
+        Point low;
+        Vector cellSize;
+        unsigned resolution[3];
+
+        // Lights of cell i are cellLights[cellStart[i]] ... cellLights[cellStart[i+1]-1]
+        std::vector< unsigned > cellStart;
+        std::vector< unsigned > cellLights;
+
+        // Cell coordinate along 'axis'. Not clamped
+        int cellCoord( double v, int axis ) const;
+        unsigned cellIndex( unsigned x, unsigned y, unsigned z ) const;
+};
+
+#endif
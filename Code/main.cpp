@@ -1,5 +1,7 @@
+#include "meshfile.h"
 #include "raytracer.h"
 
+#include <exception>
 #include <iostream>
 #include <string>
 
@@ -7,15 +9,74 @@ using namespace std;
 
 int main(int argc, char *argv[])
 {
-    cout << "Introduction to Computer Graphics - Raytracer\n\n";
+    char const *program = argv[0];
+
+    // Converts an OBJ model to the binary mesh format, which scenes can use
+    // as model instead. By default it is written where meshes look for it
+    if (argc > 2 && string(argv[1]) == "--convert")
+    {
+        if (argc > 4)
+        {
+            cerr << "Usage: " << program << " --convert model.obj [model.rtm]\n";
+            return 1;
+        }
+        string rtmFile = argc == 4 ? argv[3] : string(argv[2]) + ".rtm";
+        try
+        {
+            MeshFile::convert(argv[2], rtmFile);
+        }
+        catch (exception const &e)
+        {
+            cerr << "Error: " << e.what() << '\n';
+            return 1;
+        }
+        cout << "Converted " << argv[2] << " to " << rtmFile << '\n';
+        return 0;
+    }
+
+    // With --relight, the lights can be edited after rendering, after which
+    // the image is relit without tracing the scene again. With --stream, the
+    // rows of every frame are written while rendering, as 8-bit PPM or raw
+    // floats (see ImageStream), to out-file or stdout ("-", the default)
+    bool relight = false;
+    bool stream = false;
+    ImageStream::Format streamFormat = ImageStream::PPM;
+    while (argc > 1 && string(argv[1]).compare(0, 2, "--") == 0)
+    {
+        string option = argv[1];
+        if (option == "--relight")
+            relight = true;
+        else if (option == "--stream" && argc > 2 &&
+                 (string(argv[2]) == "ppm" || string(argv[2]) == "raw"))
+        {
+            stream = true;
+            streamFormat = string(argv[2]) == "ppm" ? ImageStream::PPM : ImageStream::RAW;
+            --argc;
+            ++argv;
+        }
+        else
+        {
+            argc = 0;   // Unknown option: print the usage
+            break;
+        }
+        --argc;
+        ++argv;
+    }
 
     if (argc < 2 || argc > 3)
     {
-        cerr << "Usage: " << argv[0] << "in-file [out-file.png]\n";
+        cerr << "Usage: " << program << " [--relight] [--stream ppm|raw] in-file [out-file.png]\n"
+             << "       " << program << " --convert model.obj [model.rtm]\n";
         return 1;
     }
 
+    // Streaming to stdout, so messages go to stderr
+    if (stream && (argc < 3 || string(argv[2]) == "-"))
+        cout.rdbuf(cerr.rdbuf());
+    cout << "Introduction to Computer Graphics - Raytracer\n\n";
+
     Raytracer raytracer;
+    raytracer.setRelightable(relight);
 
     // read the scene
     if (!raytracer.readScene(argv[1]))
@@ -31,6 +92,10 @@ int main(int argc, char *argv[])
     {
         ofname = argv[2];   // use the provided name
     }
+    else if (stream)
+    {
+        ofname = "-";
+    }
     else
     {
         ofname = argv[1];   // replace .json with .png
@@ -38,7 +103,22 @@ int main(int argc, char *argv[])
         ofname += ".png";
     }
 
+    if (stream && !raytracer.openStream(ofname, streamFormat))
+    {
+        cerr << "Error: cannot open " << ofname << " for streaming.\n";
+        return 1;
+    }
     raytracer.renderToFile(ofname);
 
+    while (relight)
+    {
+        cout << "Edit the lights in " << argv[1] << " and press enter to relight (q to quit)\n";
+        string line;
+        if (!getline(cin, line) || line == "q")
+            break;
+        if (raytracer.reloadLights(argv[1]))
+            raytracer.relightToFile(ofname);
+    }
+
     return 0;
 }
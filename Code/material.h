@@ -2,17 +2,23 @@
 #define MATERIAL_H_
 
 #include "triple.h"
-#include "image.h"
+#include "texture.h"
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
 
+// Index of a material in the material table of the scene
+typedef uint32_t MaterialId;
+
 class Material
 {
     public:
         // If 'hasTexture' is set, then 'pTexture' is set. Otherwise 'color' is set
         bool hasTexture;
         Color color;        // base color
-        std::shared_ptr< Image > pTexture;
+        std::shared_ptr< Texture > pTexture;
         double ka;          // ambient intensity
         double kd;          // diffuse intensity
         double ks;          // specular intensity
@@ -32,7 +38,7 @@ class Material
             isFlat(isFlat)
         {}
 
-        Material(std::shared_ptr< Image > pTexture, double ka, double kd, double ks, double n, bool isFlat)
+        Material(std::shared_ptr< Texture > pTexture, double ka, double kd, double ks, double n, bool isFlat)
         :
             hasTexture(true),
             pTexture(pTexture),
@@ -42,6 +48,42 @@ class Material
             n(n),
             isFlat(isFlat)
         {}
+
+        // True if both materials would shade identically
+        bool operator==(Material const &o) const
+        {
+            return hasTexture == o.hasTexture &&
+                   ( hasTexture ? pTexture == o.pTexture : color.r == o.color.r && color.g == o.color.g && color.b == o.color.b ) &&
+                   ka == o.ka && kd == o.kd && ks == o.ks && n == o.n && isFlat == o.isFlat;
+        }
+};
+
+// Hash of the fields compared by Material::operator==, to look up materials
+struct MaterialHash
+{
+    size_t operator()(Material const &m) const
+    {
+        size_t h = m.hasTexture ? std::hash< Texture * >()(m.pTexture.get()) : 0;
+        if (!m.hasTexture)
+        {
+            h = combine(h, m.color.r);
+            h = combine(h, m.color.g);
+            h = combine(h, m.color.b);
+        }
+        h = combine(h, m.ka);
+        h = combine(h, m.kd);
+        h = combine(h, m.ks);
+        h = combine(h, m.n);
+        return h ^ (size_t) m.isFlat;
+    }
+
+    private:
+        static size_t combine(size_t seed, double value)
+        {
+            // -0.0 equals 0.0, so they must hash alike
+            size_t h = std::hash< double >()(value == 0 ? 0.0 : value);
+            return seed ^ (h + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+        }
 };
 
 #endif
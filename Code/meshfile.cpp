@@ -0,0 +1,280 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#include "meshfile.h"
+
+#include "objloader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static uint32_t const MESH_VERSION = 1;
+// Leaves are split until they hold at most this many triangles
+static uint32_t const MAX_LEAF_TRIANGLES = 4;
+
+namespace {
+
+struct Bounds
+{
+    float low[ 3 ];
+    float upp[ 3 ];
+
+    static Bounds empty( ) {
+        float inf = numeric_limits< float >::infinity( );
+        return Bounds{ { inf, inf, inf }, { -inf, -inf, -inf } };
+    }
+
+    void add( Bounds const &other ) {
+        for ( int i = 0; i < 3; i++ ) {
+            low[ i ] = min( low[ i ], other.low[ i ] );
+            upp[ i ] = max( upp[ i ], other.upp[ i ] );
+        }
+    }
+
+    void add( float const *point ) {
+        for ( int i = 0; i < 3; i++ ) {
+            low[ i ] = min( low[ i ], point[ i ] );
+            upp[ i ] = max( upp[ i ], point[ i ] );
+        }
+    }
+
+    // Twice the center, which orders as well
+    float center( int axis ) const {
+        return low[ axis ] + upp[ axis ];
+    }
+};
+
+// Splits the triangles at the median of their centers along the axis in
+// which the centers are spread most
+struct HierarchyBuilder
+{
+    vector< Bounds > const &triangles;
+    vector< uint32_t > &order;
+    vector< MeshFile::Node > &nodes;
+
+    void build( uint32_t begin, uint32_t end ) {
+        Bounds box = Bounds::empty( );
+        Bounds centers = Bounds::empty( );
+        for ( uint32_t i = begin; i < end; i++ ) {
+            Bounds const &triangle = triangles[ order[ i ] ];
+            float center[] = { triangle.center( 0 ), triangle.center( 1 ), triangle.center( 2 ) };
+            box.add( triangle );
+            centers.add( center );
+        }
+
+        uint32_t index = nodes.size( );
+        nodes.push_back( MeshFile::Node{ { box.low[ 0 ], box.low[ 1 ], box.low[ 2 ] }, begin,
+                                         { box.upp[ 0 ], box.upp[ 1 ], box.upp[ 2 ] }, end - begin } );
+
+        int axis = 0;
+        for ( int i = 1; i < 3; i++ ) {
+            if ( centers.upp[ i ] - centers.low[ i ] > centers.upp[ axis ] - centers.low[ axis ] )
+                axis = i;
+        }
+        // Triangles with the same center cannot be split
+        if ( end - begin <= MAX_LEAF_TRIANGLES || !( centers.upp[ axis ] > centers.low[ axis ] ) )
+            return;
+
+        uint32_t mid = begin + ( end - begin ) / 2;
+        nth_element( order.begin( ) + begin, order.begin( ) + mid, order.begin( ) + end,
+                     [ this, axis ]( uint32_t a, uint32_t b ) {
+                         return triangles[ a ].center( axis ) < triangles[ b ].center( axis );
+                     } );
+
+        nodes[ index ].count = 0;
+        build( begin, mid );
+        nodes[ index ].offset = nodes.size( );
+        build( mid, end );
+    }
+};
+
+}
+
+MeshFile::MeshFile( )
+    : vertexData( nullptr ), indexData( nullptr ), nodeData( nullptr ), mapping( nullptr ), mappingBytes( 0 ) {
+}
+
+MeshFile::~MeshFile( ) {
+    if ( mapping )
+        munmap( mapping, mappingBytes );
+}
+
+shared_ptr< MeshFile const > MeshFile::open( string const &filename ) {
+    string const extension = ".rtm";
+    if ( filename.size( ) >= extension.size( ) &&
+         filename.compare( filename.size( ) - extension.size( ), extension.size( ), extension ) == 0 )
+        return map( filename );
+
+    string cachedName = filename + extension;
+    struct stat source, cached;
+    bool hasSource = stat( filename.c_str( ), &source ) == 0;
+    bool upToDate = stat( cachedName.c_str( ), &cached ) == 0 && ( !hasSource || cached.st_mtime >= source.st_mtime );
+    if ( upToDate ) {
+        try {
+            return map( cachedName );
+        } catch ( runtime_error const & ) {
+            // An invalid cache (e.g. of another version) is stale as well,
+            // unless there is no OBJ file to convert again
+            if ( !hasSource )
+                throw;
+        }
+    }
+
+    unique_ptr< MeshFile > mesh = build( filename );
+    // Without an OBJ file the mesh is empty, which is not worth a file.
+    // If the cache cannot be written (e.g. a read-only directory), do
+    // without it
+    if ( !hasSource || !mesh->write( cachedName ) )
+        return move( mesh );
+    return map( cachedName );
+}
+
+void MeshFile::convert( string const &objFile, string const &rtmFile ) {
+    struct stat source;
+    if ( stat( objFile.c_str( ), &source ) != 0 )
+        throw runtime_error( "Failed to open " + objFile );
+    if ( !build( objFile )->write( rtmFile ) )
+        throw runtime_error( "Failed to write mesh " + rtmFile );
+}
+
+unique_ptr< MeshFile > MeshFile::build( string const &objFile ) {
+    unique_ptr< MeshFile > mesh( new MeshFile( ) );
+    OBJLoader( objFile ).takeIndexedPositions( mesh->ownVertices, mesh->ownIndices );
+    if ( mesh->ownVertices.size( ) / 3 > numeric_limits< uint32_t >::max( ) ||
+         mesh->ownIndices.size( ) / 3 > numeric_limits< uint32_t >::max( ) )
+        throw runtime_error( "Too many vertices or triangles in " + objFile );
+
+    mesh->header.version = MESH_VERSION;
+    mesh->header.numVertices = mesh->ownVertices.size( ) / 3;
+    mesh->header.numTriangles = mesh->ownIndices.size( ) / 3;
+    mesh->buildHierarchy( );
+    mesh->header.numNodes = mesh->ownNodes.size( );
+
+    Bounds bounds = Bounds::empty( );
+    if ( !mesh->ownNodes.empty( ) ) {
+        Node const &root = mesh->ownNodes[ 0 ];
+        bounds = Bounds{ { root.lowBound[ 0 ], root.lowBound[ 1 ], root.lowBound[ 2 ] },
+                         { root.uppBound[ 0 ], root.uppBound[ 1 ], root.uppBound[ 2 ] } };
+    }
+    copy( bounds.low, bounds.low + 3, mesh->header.lowBound );
+    copy( bounds.upp, bounds.upp + 3, mesh->header.uppBound );
+
+    mesh->vertexData = mesh->ownVertices.data( );
+    mesh->indexData = mesh->ownIndices.data( );
+    mesh->nodeData = mesh->ownNodes.data( );
+    return mesh;
+}
+
+void MeshFile::buildHierarchy( ) {
+    uint32_t n = header.numTriangles;
+    vector< Bounds > triangles( n );
+    #pragma omp parallel for
+    for ( uint32_t i = 0; i < n; i++ ) {
+        triangles[ i ] = Bounds::empty( );
+        for ( int corner = 0; corner < 3; corner++ )
+            triangles[ i ].add( &ownVertices[ 3 * size_t( ownIndices[ 3 * size_t( i ) + corner ] ) ] );
+    }
+
+    vector< uint32_t > order( n );
+    iota( order.begin( ), order.end( ), 0 );
+    ownNodes.clear( );
+    if ( n > 0 )
+        HierarchyBuilder{ triangles, order, ownNodes }.build( 0, n );
+
+    // Triangles in the order of the leaves
+    vector< uint32_t > indices( ownIndices.size( ) );
+    #pragma omp parallel for
+    for ( uint32_t i = 0; i < n; i++ )
+        copy_n( &ownIndices[ 3 * size_t( order[ i ] ) ], 3, &indices[ 3 * size_t( i ) ] );
+    ownIndices.swap( indices );
+}
+
+shared_ptr< MeshFile const > MeshFile::map( string const &rtmFile ) {
+    int fd = ::open( rtmFile.c_str( ), O_RDONLY );
+    if ( fd < 0 )
+        throw runtime_error( "Failed to open mesh " + rtmFile );
+    struct stat info;
+    if ( fstat( fd, &info ) != 0 || info.st_size < off_t( 4 + sizeof( Header ) ) ) {
+        close( fd );
+        throw runtime_error( "Invalid mesh " + rtmFile + " (delete it to convert again)" );
+    }
+
+    shared_ptr< MeshFile > mesh( new MeshFile( ) );
+    mesh->mappingBytes = info.st_size;
+    mesh->mapping = mmap( nullptr, mesh->mappingBytes, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if ( mesh->mapping == MAP_FAILED ) {
+        mesh->mapping = nullptr;
+        throw runtime_error( "Failed to map mesh " + rtmFile );
+    }
+
+    char const *data = static_cast< char const * >( mesh->mapping );
+    Header &header = mesh->header;
+    memcpy( &header, data + 4, sizeof header );
+    size_t bytes = 4 + sizeof header + size_t( header.numVertices ) * 3 * sizeof( float ) +
+                   size_t( header.numTriangles ) * 3 * sizeof( uint32_t ) + size_t( header.numNodes ) * sizeof( Node );
+    if ( memcmp( data, "RTMS", 4 ) != 0 || header.version != MESH_VERSION || bytes != mesh->mappingBytes ||
+         ( header.numTriangles > 0 ) != ( header.numNodes > 0 ) )
+        throw runtime_error( "Invalid mesh " + rtmFile + " (delete it to convert again)" );
+
+    mesh->vertexData = reinterpret_cast< float const * >( data + 4 + sizeof header );
+    mesh->indexData = reinterpret_cast< uint32_t const * >( mesh->vertexData + 3 * size_t( header.numVertices ) );
+    mesh->nodeData = reinterpret_cast< Node const * >( mesh->indexData + 3 * size_t( header.numTriangles ) );
+
+    // Anything out of range is an invalid file (not a crash while rendering)
+    bool valid = true;
+    uint32_t const *indices = mesh->indexData;
+    size_t numIndices = 3 * size_t( header.numTriangles );
+    #pragma omp parallel for reduction(&&: valid)
+    for ( size_t i = 0; i < numIndices; i++ )
+        valid = valid && indices[ i ] < header.numVertices;
+    // Children follow their parents, so depths are known when reached
+    vector< unsigned > depths( header.numNodes, 0 );
+    for ( uint32_t i = 0; i < header.numNodes && valid; i++ ) {
+        Node const &node = mesh->nodeData[ i ];
+        if ( node.count > 0 ) {
+            valid = node.offset <= header.numTriangles && node.count <= header.numTriangles - node.offset;
+        } else {
+            valid = depths[ i ] < MAX_DEPTH && i + 1 < node.offset && node.offset < header.numNodes;
+            if ( valid ) {
+                depths[ i + 1 ] = max( depths[ i + 1 ], depths[ i ] + 1 );
+                depths[ node.offset ] = max( depths[ node.offset ], depths[ i ] + 1 );
+            }
+        }
+    }
+    if ( !valid )
+        throw runtime_error( "Invalid mesh " + rtmFile + " (delete it to convert again)" );
+    return mesh;
+}
+
+bool MeshFile::write( string const &rtmFile ) const {
+    // Written aside and renamed, so the file is never seen partially written,
+    // and renders that mapped the old file keep it intact
+    string tempName = rtmFile + ".tmp." + to_string( getpid( ) );
+    ofstream file( tempName, ios::binary );
+    if ( !file )
+        return false;
+
+    file.write( "RTMS", 4 );
+    file.write( (char const *) &header, sizeof header );
+    file.write( (char const *) vertexData, size_t( header.numVertices ) * 3 * sizeof( float ) );
+    file.write( (char const *) indexData, size_t( header.numTriangles ) * 3 * sizeof( uint32_t ) );
+    file.write( (char const *) nodeData, size_t( header.numNodes ) * sizeof( Node ) );
+    file.close( );
+    if ( file.fail( ) || rename( tempName.c_str( ), rtmFile.c_str( ) ) != 0 ) {
+        unlink( tempName.c_str( ) );
+        return false;
+    }
+    return true;
+}
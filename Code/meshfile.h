@@ -0,0 +1,104 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef MESHFILE_H_
+#define MESHFILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Triangle mesh model ready for intersection, as stored in a binary .rtm file.
+ *
+ * It holds float vertices in model space, three uint32 vertex indices per
+ * triangle, the bounds of the triangles and a bounding volume hierarchy over
+ * them. The triangles are ordered such that every leaf of the hierarchy
+ * holds a contiguous range of them.
+ *
+ * An .rtm file starts with the magic "RTMS" and the uint32 version, number
+ * of vertices, number of triangles and number of nodes, followed by the six
+ * float bounds (lower x, y, z, upper x, y, z). Then the vertices, indices and
+ * nodes follow as they are in memory. The file is mapped read-only and used
+ * in place, so opening a cached mesh reads nothing until it is rendered.
+ */
+class MeshFile
+{
+    public:
+        // Node of the hierarchy. Its first child directly follows it
+        struct Node
+        {
+            float lowBound[ 3 ];
+            // Index of the second child, or of the first triangle of a leaf
+            uint32_t offset;
+            float uppBound[ 3 ];
+            // Number of triangles of a leaf, zero for other nodes
+            uint32_t count;
+        };
+
+        // Levels of the hierarchy below the root, at most
+        static unsigned const MAX_DEPTH = 63;
+
+        // Opens an .rtm file. Any other file is read as OBJ file, through its
+        // cache 'filename' + ".rtm", which is written first if it does not
+        // exist, is older than the OBJ file or is invalid. If it cannot be
+        // written, the mesh is kept in memory instead
+        static std::shared_ptr< MeshFile const > open( std::string const &filename );
+        // Writes the .rtm file of an OBJ file
+        static void convert( std::string const &objFile, std::string const &rtmFile );
+
+        MeshFile( MeshFile const & ) = delete;
+        MeshFile &operator=( MeshFile const & ) = delete;
+        ~MeshFile( );
+
+        uint32_t numVertices( ) const { return header.numVertices; }
+        uint32_t numTriangles( ) const { return header.numTriangles; }
+        uint32_t numNodes( ) const { return header.numNodes; }
+
+        // x, y and z per vertex
+        float const *vertices( ) const { return vertexData; }
+        // Three per triangle
+        uint32_t const *indices( ) const { return indexData; }
+        // The root is the first node (if there are triangles)
+        Node const *nodes( ) const { return nodeData; }
+
+        // Bounds of all triangles (infinite and inverted if there are none)
+        float const *lowBound( ) const { return header.lowBound; }
+        float const *uppBound( ) const { return header.uppBound; }
+
+    private:
+        struct Header
+        {
+            uint32_t version;
+            uint32_t numVertices;
+            uint32_t numTriangles;
+            uint32_t numNodes;
+            float lowBound[ 3 ];
+            float uppBound[ 3 ];
+        };
+
+        Header header;
+        float const *vertexData;
+        uint32_t const *indexData;
+        Node const *nodeData;
+
+        // Either the mapped file, or the data itself
+        void *mapping;
+        size_t mappingBytes;
+        std::vector< float > ownVertices;
+        std::vector< uint32_t > ownIndices;
+        std::vector< Node > ownNodes;
+
+        MeshFile( );
+
+        // Builds the mesh of an OBJ file in memory
+        static std::unique_ptr< MeshFile > build( std::string const &objFile );
+        static std::shared_ptr< MeshFile const > map( std::string const &rtmFile );
+        // Returns false if the file cannot be written
+        bool write( std::string const &rtmFile ) const;
+
+        void buildHierarchy( );
+};
+
+#endif
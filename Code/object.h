@@ -17,13 +17,27 @@ typedef std::shared_ptr<Object> ObjectPtr;
 class Object
 {
     public:
-        Material material;
+        // Index into the material table of the scene
+        MaterialId material;
 
         virtual ~Object() = default;
 
         virtual Hit intersect(Ray const &ray) = 0;  // must be implemented
                                                     // in derived class
 
+        // Returns true if the ray hits the object at some 0 < t <= maxT. In
+        // that case 'primitive' is set to the part that was hit, which can
+        // be tested again through intersectPrimitive
+        virtual bool occludes(Ray const &ray, double maxT, unsigned &primitive) {
+                primitive = 0;
+                return intersect(ray).t <= maxT;
+        }
+
+        // Intersection with a single part of the object (e.g. the triangle of a mesh)
+        virtual Hit intersectPrimitive(Ray const &ray, unsigned primitive) {
+                return intersect(ray);
+        }
+
         virtual Point2 uvMap( Point p ) {
                 // Trivial implementation
 		return Point2( 0.5, 0.5 );
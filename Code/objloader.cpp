@@ -3,12 +3,176 @@
 // Pro C++ Tip: here you can specify other includes you may need
 // such as <iostream>
 
-#include <fstream>
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
+// Files are split into about this many bytes per chunk, that are parsed in
+// parallel. Small enough to balance the threads, large enough that the
+// chunks are not dominated by merging them
+static size_t const CHUNK_BYTES = 4 << 20;
+
+struct OBJLoader::Chunk
+{
+    vector<float> coordinates;
+    vector<vec3> normals;
+    vector<vec2> texCoords;
+    vector<uint32_t> coordIndices;
+    vector<uint32_t> normIndices;
+    vector<uint32_t> texIndices;
+
+    // Face vertices before the first texture coordinate of the chunk
+    size_t verticesBeforeTex = 0;
+    bool hasTexCoords = false;
+
+    // Set if parsing failed, as exceptions cannot leave the parallel loop
+    string error;
+};
+
+// ===================================================================
+// -- Tokenizer ------------------------------------------------------
+// ===================================================================
+
+// Tokens are separated by blanks, and refer into the mapped file. Nothing
+// is copied or allocated
+
+static bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static void skipBlanks(char const *&pos, char const *end)
+{
+    while (pos != end && isBlank(*pos))
+        ++pos;
+}
+
+static char const *tokenEnd(char const *pos, char const *end)
+{
+    while (pos != end && !isBlank(*pos))
+        ++pos;
+    return pos;
+}
+
+static bool isToken(char const *begin, char const *end, char const *token)
+{
+    size_t length = strlen(token);
+    return static_cast<size_t>(end - begin) == length && memcmp(begin, token, length) == 0;
+}
+
+// Slow but exact conversion of the token at 'pos', for whatever the fast
+// path of parseFloat does not handle (long mantissas, huge exponents, inf)
+static bool parseFloatSlow(char const *pos, char const *end, float &value)
+{
+    char buffer[64];
+    size_t length = end - pos;
+    if (length == 0 || length >= sizeof buffer)
+        return false;
+    memcpy(buffer, pos, length);
+    buffer[length] = 0;
+    char *parsed;
+    value = strtof(buffer, &parsed);
+    return parsed == buffer + length;
+}
+
+static double const POWERS_OF_TEN[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Parses the float token at 'pos' and moves past it. Gives the same float
+// as strtof (correctly rounded), without its locale handling: a mantissa
+// of up to 15 digits and a small power of ten are exact doubles, so their
+// product or quotient is a correctly rounded double. Rounding that to a
+// float is exact as well, unless it lies halfway between two floats
+static bool parseFloat(char const *&pos, char const *end, float &value)
+{
+    skipBlanks(pos, end);
+    char const *token = pos;
+    char const *last = tokenEnd(pos, end);
+    pos = last;
+
+    char const *cur = token;
+    bool negative = false;
+    if (cur != last && (*cur == '-' || *cur == '+'))
+        negative = *cur++ == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0;         // significant digits in the mantissa
+    int exponent = 0;
+    bool anyDigits = false;
+    for (; cur != last && isDigit(*cur); ++cur, anyDigits = true)
+    {
+        mantissa = mantissa * 10 + (*cur - '0');
+        digits += (mantissa != 0);
+    }
+    if (cur != last && *cur == '.')
+    {
+        for (++cur; cur != last && isDigit(*cur); ++cur, anyDigits = true)
+        {
+            mantissa = mantissa * 10 + (*cur - '0');
+            digits += (mantissa != 0);
+            --exponent;
+        }
+    }
+    if (cur != last && (*cur == 'e' || *cur == 'E'))
+    {
+        ++cur;
+        bool negativeExp = false;
+        if (cur != last && (*cur == '-' || *cur == '+'))
+            negativeExp = *cur++ == '-';
+        int exp = 0;
+        for (; cur != last && isDigit(*cur) && exp < 1000; ++cur)
+            exp = exp * 10 + (*cur - '0');
+        exponent += negativeExp ? -exp : exp;
+    }
+
+    if (!anyDigits || cur != last || digits > 15 || exponent < -22 || exponent > 22)
+        return parseFloatSlow(token, last, value);
+
+    double result = static_cast<double>(mantissa);
+    result = exponent < 0 ? result / POWERS_OF_TEN[-exponent] : result * POWERS_OF_TEN[exponent];
+    uint64_t bits;
+    memcpy(&bits, &result, sizeof bits);
+    bool halfway = (bits & 0x1FFFFFFF) == 0x10000000;   // of the 29 bits floats lack
+    if (result != 0 && (halfway || result < FLT_MIN || result > FLT_MAX))
+        return parseFloatSlow(token, last, value);
+
+    value = static_cast<float>(negative ? -result : result);
+    return true;
+}
+
+// Parses a 1-based index into a 0-based one. Returns false if there are no
+// digits. Indices that do not fit become UINT32_MAX, which is out of range
+static bool parseIndex(char const *&pos, char const *end, uint32_t &index)
+{
+    if (pos == end || !isDigit(*pos))
+        return false;
+    uint64_t number = 0;
+    for (; pos != end && isDigit(*pos); ++pos)
+        number = min<uint64_t>(number * 10 + (*pos - '0'), UINT32_MAX);
+    index = static_cast<uint32_t>(number) - 1U;   // Wavefront .obj files start counting from 1
+    return true;
+}
+
 // ===================================================================
 // -- Constructors and destructor ------------------------------------
 // ===================================================================
@@ -30,21 +194,23 @@ OBJLoader::OBJLoader(string const &filename)
 
 vector<Vertex> OBJLoader::vertex_data() const
 {
-    vector<Vertex> data;
+    vector<Vertex> data(d_coordIndices.size());
 
-    // For all vertices in the model, interleave the data
-    for (Vertex_idx const &vertex : d_vertices)
+    // For all vertices in the model, interleave the data. The indices
+    // are checked while loading
+    #pragma omp parallel for
+    for (size_t idx = 0; idx < d_coordIndices.size(); ++idx)
     {
-        // Add coordinate data
-        Vertex vert;
+        Vertex &vert = data[idx];
 
-        vec3 const coord = d_coordinates.at(vertex.d_coord);
-        vert.x = coord.x;
-        vert.y = coord.y;
-        vert.z = coord.z;
+        // Add coordinate data
+        float const *coord = &d_coordinates[3 * size_t(d_coordIndices[idx])];
+        vert.x = coord[0];
+        vert.y = coord[1];
+        vert.z = coord[2];
 
         // Add normal data
-        vec3 const norm = d_normals.at(vertex.d_norm);
+        vec3 const &norm = d_normals[d_normIndices[idx]];
         vert.nx = norm.x;
         vert.ny = norm.y;
         vert.nz = norm.z;
@@ -52,22 +218,39 @@ vector<Vertex> OBJLoader::vertex_data() const
         // Add texture data (if available)
         if (d_hasTexCoords)
         {
-            vec2 const tex = d_texCoords.at(vertex.d_tex);
+            vec2 const &tex = d_texCoords[d_texIndices[idx]];
             vert.u = tex.u;      // u coordinate
             vert.v = tex.v;      // v coordinate
         } else {
             vert.u = 0;
             vert.v = 0;
         }
-        data.push_back(vert);
     }
 
     return data;    // copy elision
 }
 
+void OBJLoader::takeIndexedPositions(vector<float> &positions,
+                                     vector<uint32_t> &indices)
+{
+    // A partial last face is dropped, as by vertex_data users
+    d_coordIndices.resize(d_coordIndices.size() - d_coordIndices.size() % 3);
+    positions = move(d_coordinates);
+    indices = move(d_coordIndices);
+
+    // The rest is of no use without them
+    d_hasTexCoords = false;
+    d_coordinates.clear();
+    d_coordIndices.clear();
+    vector<vec3>().swap(d_normals);
+    vector<vec2>().swap(d_texCoords);
+    vector<uint32_t>().swap(d_normIndices);
+    vector<uint32_t>().swap(d_texIndices);
+}
+
 unsigned OBJLoader::numTriangles() const
 {
-    return d_vertices.size() / 3U;
+    return d_coordIndices.size() / 3U;
 }
 
 bool OBJLoader::hasTexCoords() const
@@ -106,100 +289,186 @@ void OBJLoader::unitize()
 
 void OBJLoader::parseFile(string const &filename)
 {
-    ifstream file(filename);
-    if (file)
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
     {
-        string line;
-        while(getline(file, line))
-            parseLine(line);
-
-    } else {
         cerr << "Could not open: " << filename << " for reading!\n";
+        if (fd >= 0)
+            close(fd);
+        return;
     }
-}
-
-void OBJLoader::parseLine(string const &line)
-{
-    if (line[0] == '#')
-        return;                     // ignore comments
-
-    StringList tokens = split(line, ' ', false);
-
-    if (tokens[0] == "v")
-        parseVertex(tokens);
-    else if (tokens[0] == "vn")
-        parseNormal(tokens);
-    else if (tokens[0] == "vt")
-        parseTexCoord(tokens);
-    else if (tokens[0] == "f")
-        parseFace(tokens);
-
-    // Other data is also ignored
-}
 
-void OBJLoader::parseVertex(StringList const &tokens)
-{
-    float x, y, z;
-    x = stof(tokens.at(1));         // 0 is the "v" token
-    y = stof(tokens.at(2));
-    z = stof(tokens.at(3));
-    d_coordinates.push_back(vec3{x, y, z});
-}
-
-void OBJLoader::parseNormal(StringList const &tokens)
-{
-    float x, y, z;
-    x = stof(tokens.at(1));         // 0 is the "vn" token
-    y = stof(tokens.at(2));
-    z = stof(tokens.at(3));
-    d_normals.push_back(vec3{x, y, z});
-}
-
-void OBJLoader::parseTexCoord(StringList const &tokens)
-{
-    d_hasTexCoords = true;          // Texture data will be read
-
-    float u, v;
-    u = stof(tokens.at(1));         // 0 is the "vt" token
-    v = stof(tokens.at(2));
-    d_texCoords.push_back(vec2{u, v});
+    size_t size = info.st_size;
+    void *map = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);                  // the mapping stays
+    if (map == MAP_FAILED)
+    {
+        if (size > 0)
+            cerr << "Could not map: " << filename << " for reading!\n";
+        return;
+    }
+    madvise(map, size, MADV_WILLNEED);
+
+    // Chunks start at the beginning of a line
+    char const *data = static_cast<char const *>(map);
+    char const *dataEnd = data + size;
+    size_t maxChunks = 4 * static_cast<size_t>(omp_get_max_threads());
+    size_t numChunks = max(min(size / CHUNK_BYTES, maxChunks), size_t(1));
+    vector<char const *> bounds(1, data);
+    for (size_t idx = 1; idx < numChunks; ++idx)
+    {
+        char const *pos = max(data + size * idx / numChunks, bounds.back());
+        char const *newline = static_cast<char const *>(memchr(pos, '\n', dataEnd - pos));
+        bounds.push_back(newline ? newline + 1 : dataEnd);
+    }
+    bounds.push_back(dataEnd);
+
+    vector<Chunk> chunks(numChunks);
+    #pragma omp parallel for schedule(dynamic)
+    for (int idx = 0; idx < static_cast<int>(numChunks); ++idx)
+        parseChunk(bounds[idx], bounds[idx + 1], chunks[idx]);
+
+    munmap(map, size);
+    for (Chunk const &chunk : chunks)
+        if (!chunk.error.empty())
+            throw runtime_error("Invalid line in " + filename + ": " + chunk.error);
+    merge(chunks);
 }
 
-void OBJLoader::parseFace(StringList const &tokens)
+void OBJLoader::parseChunk(char const *begin, char const *end, Chunk &chunk)
 {
-    // skip the first token ("f")
-    for (size_t idx = 1; idx < tokens.size(); ++idx)
+    char const *line = begin;
+    while (line != end)
     {
-        // format is:
-        // <vertex idx + 1>/<texture idx +1>/<normal idx + 1>
-        // Wavefront .obj files start counting from 1 (yuck)
+        char const *lineEnd = static_cast<char const *>(memchr(line, '\n', end - line));
+        if (lineEnd == nullptr)
+            lineEnd = end;
 
-        StringList elements = split(tokens.at(idx), '/');
-        Vertex_idx vertex {}; // initialize to zeros on all fields
+        char const *pos = line;
+        skipBlanks(pos, lineEnd);
+        char const *keyword = pos;
+        pos = tokenEnd(pos, lineEnd);
+        bool valid = true;
 
-        vertex.d_coord = stoul(elements.at(0)) - 1U;
-
-        if (d_hasTexCoords)
-            vertex.d_tex = stoul(elements.at(1)) - 1U;
-        else
-            vertex.d_tex = 0U;       // ignored
+        if (isToken(keyword, pos, "v"))
+        {
+            float x, y, z;
+            valid = parseFloat(pos, lineEnd, x) && parseFloat(pos, lineEnd, y)
+                    && parseFloat(pos, lineEnd, z);
+            chunk.coordinates.insert(chunk.coordinates.end(), { x, y, z });
+        }
+        else if (isToken(keyword, pos, "vn"))
+        {
+            vec3 norm;
+            valid = parseFloat(pos, lineEnd, norm.x) && parseFloat(pos, lineEnd, norm.y)
+                    && parseFloat(pos, lineEnd, norm.z);
+            chunk.normals.push_back(norm);
+        }
+        else if (isToken(keyword, pos, "vt"))
+        {
+            if (!chunk.hasTexCoords)
+                chunk.verticesBeforeTex = chunk.coordIndices.size();
+            chunk.hasTexCoords = true;
 
-        vertex.d_norm = stoul(elements.at(2)) - 1U;
+            vec2 tex;
+            valid = parseFloat(pos, lineEnd, tex.u) && parseFloat(pos, lineEnd, tex.v);
+            chunk.texCoords.push_back(tex);
+        }
+        else if (isToken(keyword, pos, "f"))
+        {
+            // format is:
+            // <vertex idx + 1>/<texture idx +1>/<normal idx + 1>
+            // where the texture index may be empty
+            for (skipBlanks(pos, lineEnd); valid && pos != lineEnd; skipBlanks(pos, lineEnd))
+            {
+                uint32_t coord = 0, tex = 0, norm = 0;
+                valid = parseIndex(pos, lineEnd, coord)
+                        && pos != lineEnd && *pos++ == '/';
+                if (valid && pos != lineEnd && isDigit(*pos))
+                    parseIndex(pos, lineEnd, tex);
+                valid = valid && pos != lineEnd && *pos++ == '/'
+                        && parseIndex(pos, lineEnd, norm)
+                        && (pos == lineEnd || isBlank(*pos));
+                chunk.coordIndices.push_back(coord);
+                chunk.texIndices.push_back(tex);
+                chunk.normIndices.push_back(norm);
+            }
+        }
+        // Comments and other data are ignored
 
-        d_vertices.push_back(vertex);
+        if (!valid)
+        {
+            chunk.error = string(line, lineEnd);
+            return;
+        }
+        line = lineEnd == end ? end : lineEnd + 1;
     }
+
+    if (!chunk.hasTexCoords)
+        chunk.verticesBeforeTex = chunk.coordIndices.size();
 }
 
-OBJLoader::StringList OBJLoader::split(string const &line,
-                            char splitChar,
-                            bool keepEmpty)
+void OBJLoader::merge(vector<Chunk> &chunks)
 {
-    StringList tokens;
-    istringstream iss(line);
-    string token;
-    while (getline(iss, token, splitChar))
-        if (token.size() > 0 || (token.size() == 0 && keepEmpty))
-            tokens.push_back(token);
+    if (chunks.size() == 1)
+    {
+        // Nothing to append to, so the arrays are moved as they are
+        Chunk &chunk = chunks[0];
+        fill(chunk.texIndices.begin(), chunk.texIndices.begin() + chunk.verticesBeforeTex, 0U);
+        d_hasTexCoords = chunk.hasTexCoords;
+        d_coordinates = move(chunk.coordinates);
+        d_normals = move(chunk.normals);
+        d_texCoords = move(chunk.texCoords);
+        d_coordIndices = move(chunk.coordIndices);
+        d_normIndices = move(chunk.normIndices);
+        d_texIndices = move(chunk.texIndices);
+    }
+    else
+    {
+        size_t numCoords = 0, numNormals = 0, numTexCoords = 0, numVertices = 0;
+        for (Chunk const &chunk : chunks)
+        {
+            numCoords += chunk.coordinates.size();
+            numNormals += chunk.normals.size();
+            numTexCoords += chunk.texCoords.size();
+            numVertices += chunk.coordIndices.size();
+        }
+        d_coordinates.reserve(numCoords);
+        d_normals.reserve(numNormals);
+        d_texCoords.reserve(numTexCoords);
+        d_coordIndices.reserve(numVertices);
+        d_normIndices.reserve(numVertices);
+        d_texIndices.reserve(numVertices);
+
+        for (Chunk &chunk : chunks)
+        {
+            // Texture indices of faces before the first texture coordinate
+            // of the file are ignored
+            if (!d_hasTexCoords)
+                fill(chunk.texIndices.begin(), chunk.texIndices.begin() + chunk.verticesBeforeTex, 0U);
+            d_hasTexCoords = d_hasTexCoords || chunk.hasTexCoords;
+
+            d_coordinates.insert(d_coordinates.end(), chunk.coordinates.begin(), chunk.coordinates.end());
+            d_normals.insert(d_normals.end(), chunk.normals.begin(), chunk.normals.end());
+            d_texCoords.insert(d_texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+            d_coordIndices.insert(d_coordIndices.end(), chunk.coordIndices.begin(), chunk.coordIndices.end());
+            d_normIndices.insert(d_normIndices.end(), chunk.normIndices.begin(), chunk.normIndices.end());
+            d_texIndices.insert(d_texIndices.end(), chunk.texIndices.begin(), chunk.texIndices.end());
+            chunk = Chunk();        // free it early
+        }
+    }
 
-    return tokens;
+    // Checked once here, so vertex_data needs no checks
+    size_t numPositions = d_coordinates.size() / 3;
+    bool valid = true;
+    #pragma omp parallel for reduction(&&: valid)
+    for (size_t idx = 0; idx < d_coordIndices.size(); ++idx)
+    {
+        valid = valid && d_coordIndices[idx] < numPositions
+                && d_normIndices[idx] < d_normals.size()
+                && (!d_hasTexCoords || d_texIndices[idx] < d_texCoords.size());
+    }
+    if (!valid)
+        throw out_of_range("OBJ face refers to a missing vertex, normal or texture coordinate");
 }
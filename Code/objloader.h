@@ -7,6 +7,7 @@
 
 #include "vertex.h"
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -27,26 +28,21 @@ class OBJLoader
         float v;
     };
 
-    std::vector<vec3> d_coordinates;
+    // x, y and z of every vertex position
+    std::vector<float> d_coordinates;
     std::vector<vec3> d_normals;
     std::vector<vec2> d_texCoords;
 
     /**
-     * @brief The Vertex struct
-     * Contains indices into the above
-     * QVectors to be able to reconstruct
-     * the model
+     * Per face corner, the indices into the above to be able
+     * to reconstruct the model
      */
-    struct Vertex_idx
-    {
-        size_t d_coord;
-        size_t d_norm;
-        size_t d_tex;
-    };
-
-    std::vector<Vertex_idx> d_vertices;
+    std::vector<uint32_t> d_coordIndices;
+    std::vector<uint32_t> d_normIndices;
+    std::vector<uint32_t> d_texIndices;
 
-    typedef std::vector<std::string> StringList;
+    // The data of a piece of the file, see parseChunk
+    struct Chunk;
 
     public:
 
@@ -65,6 +61,17 @@ class OBJLoader
          */
         std::vector<Vertex> vertex_data() const;
 
+        /**
+         * @brief takeIndexedPositions: moves the mesh out of the loader,
+         * without expanding it per face corner
+         * @param positions: x, y and z of every vertex
+         * @param indices: 3 indices into the vertices per triangle
+         *
+         * @note the loader is empty afterwards
+         */
+        void takeIndexedPositions(std::vector<float> &positions,
+                                  std::vector<uint32_t> &indices);
+
         unsigned numTriangles() const;
 
         bool hasTexCoords() const;
@@ -79,15 +86,16 @@ class OBJLoader
     private:
 
         void parseFile(std::string const &filename);
-        void parseLine(std::string const &line);
-        void parseVertex(StringList const &tokens);
-        void parseNormal(StringList const &tokens);
-        void parseTexCoord(StringList const &tokens);
-        void parseFace(StringList const &tokens);
-
-        StringList split(std::string const &str,
-                             char splitChar,
-                             bool keepEmpty = true);
+
+        /**
+         * @brief parseChunk: parses the lines in [begin, end)
+         * Face indices are kept as in the file (they are
+         * absolute), so chunks can be parsed independently
+         */
+        static void parseChunk(char const *begin, char const *end, Chunk &chunk);
+
+        // Appends the chunks in order and checks all indices
+        void merge(std::vector<Chunk> &chunks);
 
 };
 
@@ -1,5 +1,7 @@
 #include "raytracer.h"
 
+#include "aovbuffer.h"
+#include "exr.h"
 #include "image.h"
 #include "light.h"
 #include "material.h"
@@ -23,13 +25,81 @@
 
 #include "json/json.h"
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <exception>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <set>
+
+#include <sys/stat.h>
 
 using namespace std;        // no std:: required
 using json = nlohmann::json;
 
+// Width and height of the rendered images
+static unsigned const IMAGE_SIZE = 400;
+
+// File formats of the output image, by extension. Anything else is PNG
+enum class OutputFormat { PNG, PFM, EXR };
+
+// Hash of a sequence of values, from the hash of those before and the next
+static size_t combineHash(size_t seed, size_t value)
+{
+    return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+// Hash of a parsed value. Walks the values instead of serializing them, as
+// every light and object of a (huge) scene is hashed
+static size_t hashJson(json const &value)
+{
+    size_t seed = static_cast<size_t>(value.type());
+    switch (value.type())
+    {
+        case json::value_t::object:
+            for (auto it = value.begin(); it != value.end(); ++it)
+                seed = combineHash(combineHash(seed, hash<string>()(it.key())), hashJson(it.value()));
+            break;
+        case json::value_t::array:
+            for (json const &element : value)
+                seed = combineHash(seed, hashJson(element));
+            break;
+        case json::value_t::string:
+            seed = combineHash(seed, hash<string>()(value.get_ref<json::string_t const &>()));
+            break;
+        case json::value_t::boolean:
+            seed = combineHash(seed, hash<bool>()(value.get<bool>()));
+            break;
+        case json::value_t::number_integer:
+            seed = combineHash(seed, hash<json::number_integer_t>()(value.get<json::number_integer_t>()));
+            break;
+        case json::value_t::number_unsigned:
+            seed = combineHash(seed, hash<json::number_unsigned_t>()(value.get<json::number_unsigned_t>()));
+            break;
+        case json::value_t::number_float:
+            seed = combineHash(seed, hash<json::number_float_t>()(value.get<json::number_float_t>()));
+            break;
+        default:
+            break;
+    }
+    return seed;
+}
+
+static OutputFormat outputFormat(string const &ofname)
+{
+    size_t dot = ofname.find_last_of('.');
+    string extension = dot == string::npos ? "" : ofname.substr(dot + 1);
+    transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension == "pfm")
+        return OutputFormat::PFM;
+    if (extension == "exr")
+        return OutputFormat::EXR;
+    return OutputFormat::PNG;
+}
+
 bool Raytracer::parseObjectNode(json const &node, const std::string& sceneDirPath)
 {
     ObjectPtr obj = nullptr;
@@ -93,7 +163,7 @@ bool Raytracer::parseObjectNode(json const &node, const std::string& sceneDirPat
         return false;
 
     // Parse material and add object to the scene
-    obj->material = parseMaterialNode(node["material"],sceneDirPath);
+    obj->material = scene.addMaterial(parseMaterialNode(node["material"],sceneDirPath));
     scene.addObject(obj);
     return true;
 }
@@ -102,10 +172,27 @@ Light Raytracer::parseLightNode(json const &node) const
 {
     Point pos(node["position"]);
     Color col(node["color"]);
-    return Light(pos, col);
+    double range = numeric_limits<double>::infinity();
+    if ( node.count("range") != 0 ) {
+        range = node["range"];
+    }
+    // Maximum number of shadow rays towards an area light per point
+    unsigned samples = 16;
+    if ( node.count("samples") != 0 ) {
+        samples = node["samples"];
+    }
+
+    if ( node.count("type") == 0 || node["type"] == "point" ) {
+        return Light(pos, col, range);
+    } else if ( node["type"] == "rectangle" ) {
+        return Light::rectangle(pos, Vector(node["edge1"]), Vector(node["edge2"]), col, samples, range);
+    } else if ( node["type"] == "sphere" ) {
+        return Light::sphere(pos, node["radius"], col, samples, range);
+    }
+    throw runtime_error("Unknown light type: " + node["type"].dump());
 }
 
-Material Raytracer::parseMaterialNode(json const &node, const std::string& sceneDirPath) const
+Material Raytracer::parseMaterialNode(json const &node, const std::string& sceneDirPath)
 {
     bool isFlat = ( node.count( "is_flat" ) != 0 && node[ "is_flat" ] );
     double ka = node["ka"];
@@ -117,7 +204,7 @@ Material Raytracer::parseMaterialNode(json const &node, const std::string& scene
         return Material(Color(node["color"]), ka, kd, ks, n, isFlat);
     } else {
         std::string filename = sceneDirPath + node["texture"].get<std::string>( );
-        return Material(std::make_shared< Image >(filename), ka, kd, ks, n, isFlat);
+        return Material(textures.load(filename), ka, kd, ks, n, isFlat);
     }
 }
 
@@ -126,11 +213,57 @@ try
 {
     std::string sceneDirPath = ifname.substr( 0, ifname.find_last_of( "/" ) + 1 );
 
-    // Read and parse input json file
+    // Read and parse input json file. The lights and objects are added while
+    // the file is parsed, as soon as their nodes are complete, after which the
+    // nodes are dropped. Only the other settings remain in 'jsonscene', so a
+    // huge scene is never in memory as a whole
     ifstream infile(ifname);
     if (!infile) throw runtime_error("Could not open input file for reading.");
-    json jsonscene;
-    infile >> jsonscene;
+    string section;             // Top-level key of the value being parsed
+    unsigned objCount = 0;
+    size_t lightsHash = 0;      // Of the geometry, for the shadow map cache
+    size_t objectsHash = 0;
+    set<string> models;         // Model files of the objects, without repeats
+    auto parseNode = [&](int depth, json::parse_event_t event, json &parsed)
+    {
+        if (depth == 1 && event == json::parse_event_t::key)
+        {
+            section = parsed.get<string>();
+            return true;
+        }
+        if (depth == 1 && event == json::parse_event_t::value && section == "TextureMemoryBudget")
+        {
+            // In MiB. Textures are paged in by tiles within this budget. Set
+            // right away, such that the textures of the next objects are not
+            // read into memory as a whole first
+            if (parsed.is_number())
+                textures.setMemoryBudget((size_t) (parsed.get<double>() * 1024 * 1024));
+            return true;
+        }
+
+        // Elements of the arrays of lights and objects. Every value is also
+        // reported after it ends, when dropped elements are discarded
+        bool isElement = depth == 2 && (event == json::parse_event_t::object_end ||
+                                        event == json::parse_event_t::array_end ||
+                                        (event == json::parse_event_t::value && !parsed.is_discarded()));
+        if (isElement && section == "Lights")
+        {
+            scene.addLight(parseLightNode(parsed));
+            lightsHash = combineHash(lightsHash, hashJson(parsed));
+            return false;
+        }
+        if (isElement && section == "Objects")
+        {
+            if (parseObjectNode(parsed, sceneDirPath))
+                ++objCount;
+            objectsHash = combineHash(objectsHash, hashJson(parsed));
+            if (parsed.is_object() && parsed.count("model") != 0 && parsed["model"].is_string())
+                models.insert(parsed["model"].get_ref<json::string_t const &>());
+            return false;
+        }
+        return true;
+    };
+    json jsonscene = json::parse(infile, parseNode);
 
 // =============================================================================
 // -- Read your scene data in this section -------------------------------------
@@ -157,16 +290,68 @@ try
     } else {
         scene.setSuperSamplingFactor( 0 );
     }
-
-    for (auto const &lightNode : jsonscene["Lights"])
-        scene.addLight(parseLightNode(lightNode));
-
-    unsigned objCount = 0;
-    for (auto const &objectNode : jsonscene["Objects"])
-        if (parseObjectNode(objectNode,sceneDirPath))
-            ++objCount;
+    if ( jsonscene["MinRayWeight"].is_number( ) ) {
+        scene.setMinRayWeight( jsonscene["MinRayWeight"] );
+    }
+    scene.setRussianRoulette( jsonscene["RussianRoulette"].is_boolean( ) && jsonscene["RussianRoulette"] );
+    if ( jsonscene["LightCullThreshold"].is_number( ) ) {
+        scene.setLightCullThreshold( jsonscene["LightCullThreshold"] );
+    }
+    if ( jsonscene["LightSamples"].is_number( ) ) {
+        scene.setLightSamples( jsonscene["LightSamples"] );
+    }
+    if ( jsonscene["ShadowMapResolution"].is_number( ) ) {
+        // Shadows only depend on the lights and objects, so the maps stay
+        // valid when the camera moves
+        unsigned resolution = jsonscene["ShadowMapResolution"];
+        // They also change when a model file is edited
+        for ( string const &model : models ) {
+            struct stat info;
+            if ( stat( ( sceneDirPath + model ).c_str( ), &info ) == 0 ) {
+                objectsHash = combineHash( objectsHash, (size_t) info.st_size );
+                objectsHash = combineHash( objectsHash, (size_t) info.st_mtime );
+            }
+        }
+        size_t geometry = combineHash( combineHash( lightsHash, objectsHash ), resolution );
+        scene.setShadowMaps( resolution, ifname + ".shadowmaps", geometry );
+    }
+    if ( jsonscene["ShadowMapTolerance"].is_number( ) ) {
+        scene.setShadowMapTolerance( jsonscene["ShadowMapTolerance"],
+            !jsonscene["ShadowMapExactEdges"].is_boolean( ) || jsonscene["ShadowMapExactEdges"] );
+    } else if ( jsonscene["ShadowMapExactEdges"].is_boolean( ) ) {
+        scene.setShadowMapTolerance( 0.001, jsonscene["ShadowMapExactEdges"] );
+    }
+    scene.setExactSpecular( jsonscene["ExactSpecular"].is_boolean( ) && jsonscene["ExactSpecular"] );
+    if ( jsonscene["TextureFilter"].is_string( ) ) {
+        string filter = jsonscene["TextureFilter"];
+        if ( filter == "nearest" )
+            scene.setTextureFilter( Texture::NEAREST );
+        else if ( filter == "bilinear" )
+            scene.setTextureFilter( Texture::BILINEAR );
+        else if ( filter == "trilinear" )
+            scene.setTextureFilter( Texture::TRILINEAR );
+        else
+            throw runtime_error( "Unknown texture filter: " + filter );
+    }
+    scene.setWavefront( jsonscene["Wavefront"].is_boolean( ) && jsonscene["Wavefront"] );
+    if ( jsonscene["SortRays"].is_boolean( ) ) {
+        scene.setSortSecondaryRays( jsonscene["SortRays"] );
+    }
+    scene.setDeferredShading( jsonscene["Deferred"].is_boolean( ) && jsonscene["Deferred"] );
+    if ( jsonscene["Wavefront"] == true && jsonscene["Deferred"] == true )
+        cerr << "Deferred shading is ignored, as the scene is rendered by wavefront.\n";
+    if ( jsonscene["GBufferFile"].is_string( ) ) {
+        scene.setGBufferFile( jsonscene["GBufferFile"] );
+    }
+    if ( jsonscene["PngCompression"].is_number_integer( ) ) {
+        // 0 (store) for fast intermediate frames up to 9 (smallest)
+        pngCompression = jsonscene["PngCompression"];
+        if ( pngCompression < 0 || pngCompression > 9 )
+            throw runtime_error( "PngCompression must be from 0 to 9" );
+    }
 
     cout << "Parsed " << objCount << " objects.\n";
+    textures.printReport(cout);
 
 // =============================================================================
 // -- End of scene data reading ------------------------------------------------
@@ -180,13 +365,101 @@ catch (exception const &ex)
     return false;
 }
 
+bool Raytracer::reloadLights(string const &ifname)
+try
+{
+    ifstream infile(ifname);
+    if (!infile) return false;
+    // The objects are skipped without building their nodes
+    string section;
+    json jsonscene = json::parse(infile, [&](int depth, json::parse_event_t event, json &parsed)
+    {
+        if (depth == 1 && event == json::parse_event_t::key)
+            section = parsed.get<string>();
+        return depth != 1 || event != json::parse_event_t::array_start || section != "Objects";
+    });
+
+    if ( jsonscene.count( "AmbientLight" ) > 0 ) {
+      scene.setAmbientLight( Color( jsonscene[ "AmbientLight" ] ) );
+    } else {
+      scene.clearAmbientLight( );
+    }
+
+    vector<Light> lights;
+    for (auto const &lightNode : jsonscene["Lights"])
+        lights.push_back(parseLightNode(lightNode));
+    if (!scene.updateLights(lights))
+    {
+        cerr << "The number of lights changed. Restart to render them.\n";
+        return false;
+    }
+    return true;
+}
+catch (exception const &ex)
+{
+    cerr << ex.what() << '\n';
+    return false;
+}
+
+bool Raytracer::openStream(string const &ofname, ImageStream::Format format)
+{
+    if (!stream.open(ofname, format))
+        return false;
+    scene.setImageStream(&stream);
+    return true;
+}
+
+void Raytracer::setRelightable(bool relightable)
+{
+    scene.setRelightable(relightable);
+}
+
+void Raytracer::relightToFile(string const &ofname)
+{
+    Image img(IMAGE_SIZE, IMAGE_SIZE);
+    AovBuffer aovs;
+    bool withAovs = !stream.isOpen() && outputFormat(ofname) == OutputFormat::EXR;
+    auto start = chrono::steady_clock::now();
+    unsigned numMoved = scene.relight(img, withAovs ? &aovs : nullptr);
+    auto end = chrono::steady_clock::now();
+    cout << "Relit in " << chrono::duration<double, milli>(end - start).count() << " ms ("
+         << numMoved << " moved lights traced again).\n";
+    writeImage(ofname, img, withAovs ? &aovs : nullptr);
+}
+
 void Raytracer::renderToFile(string const &ofname)
 {
     // TODO: the size may be a settings in your file
-    Image img(400, 400);
+    Image img(IMAGE_SIZE, IMAGE_SIZE);
+    AovBuffer aovs;
+    OutputFormat format = outputFormat(ofname);
+    bool withAovs = !stream.isOpen() && format == OutputFormat::EXR;
+    // Float formats keep the radiance above 1, for changing the exposure later
+    if (stream.isOpen())
+        scene.setClampSamples(stream.format() == ImageStream::PPM);
+    else
+        scene.setClampSamples(format == OutputFormat::PNG);
     cout << "Tracing...\n";
-    scene.render(img);
-    cout << "Writing image to " << ofname << "...\n";
-    img.write_png(ofname);
+    scene.render(img, withAovs ? &aovs : nullptr);
+    scene.getStats( ).print( cout );
+    textures.printCacheStats( cout );
+    if (!stream.isOpen())
+        cout << "Writing image to " << ofname << "...\n";
+    writeImage(ofname, img, withAovs ? &aovs : nullptr);
     cout << "Done.\n";
 }
+
+void Raytracer::writeImage(string const &ofname, Image const &img, AovBuffer const *aovs) const
+{
+    bool written = true;
+    if (stream.isOpen())
+        written = stream.good();    // It was written while rendering
+    else switch (outputFormat(ofname))
+    {
+        case OutputFormat::PNG: img.write_png(ofname, pngCompression); break;
+        case OutputFormat::PFM: written = img.write_pfm(ofname); break;
+        case OutputFormat::EXR: written = writeExr(ofname, img, aovs); break;
+    }
+    if (!written)
+        cerr << "Error: writing " << ofname << " failed.\n";
+}
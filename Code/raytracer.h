@@ -1,11 +1,15 @@
 #ifndef RAYTRACER_H_
 #define RAYTRACER_H_
 
+#include "image.h"
+#include "imagestream.h"
 #include "scene.h"
+#include "textureregistry.h"
 
 #include <string>
 
 // Forward declerations
+class AovBuffer;
 class Light;
 class Material;
 
@@ -14,18 +18,40 @@ class Material;
 class Raytracer
 {
     Scene scene;
+    // Textures are shared by all materials that use them
+    TextureRegistry textures;
+    // zlib level of the written PNG files (0 is store only)
+    int pngCompression = Image::DEFAULT_PNG_COMPRESSION;
+    // If open, frames are streamed into it instead of written to image files
+    ImageStream stream;
 
     public:
 
         bool readScene(std::string const &ifname);
         void renderToFile(std::string const &ofname);
 
+        // Stream the rows of the frames to 'ofname' ("-" for stdout) while
+        // they are rendered. Returns false if it cannot be opened
+        bool openStream(std::string const &ofname, ImageStream::Format format);
+
+        // Keep the light transport of the render for relighting
+        void setRelightable(bool relightable);
+        // Reads the lights and ambient light of the scene file again. Fails if
+        // lights were added or removed
+        bool reloadLights(std::string const &ifname);
+        // Renders the image again for the reloaded lights
+        void relightToFile(std::string const &ofname);
+
     private:
 
         bool parseObjectNode(nlohmann::json const &node, const std::string& sceneDirPath);
 
         Light parseLightNode(nlohmann::json const &node) const;
-        Material parseMaterialNode(nlohmann::json const &node, const std::string& sceneDirPath) const;
+        Material parseMaterialNode(nlohmann::json const &node, const std::string& sceneDirPath);
+
+        // Writes the image in the format of the extension of 'ofname' (PNG,
+        // PFM or EXR). Only EXR files store the AOVs
+        void writeImage(std::string const &ofname, Image const &img, AovBuffer const *aovs) const;
 };
 
 #endif
@@ -0,0 +1,159 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#include "relight.h"
+
+#include "scene.h"
+
+#include <algorithm>
+
+#include <omp.h>
+
+using namespace std;
+
+// Concatenates the per-thread parts in thread order, so the result does not
+// depend on scheduling
+template < class T >
+static void concat( vector< vector< T > > &parts, vector< T > &dst ) {
+    dst.clear( );
+    for ( vector< T > &part : parts ) {
+        dst.insert( dst.end( ), part.begin( ), part.end( ) );
+        part.clear( );
+    }
+}
+
+void Relighter::capture( Scene &scene ) {
+    GBuffer const &gBuffer = scene.gBuffer;
+    unsigned w = gBuffer.width( );
+    unsigned h = gBuffer.height( );
+    unsigned spp = gBuffer.samplesPerPixel( );
+    unsigned ssFactor = max( scene.superSamplingFactor, 1u );
+    int numSamples = gBuffer.size( );
+
+    constant.assign( numSamples, Color( ) );
+    ambient.assign( numSamples, Color( ) );
+    vector< vector< Vertex > > threadVertices( omp_get_max_threads( ) );
+
+    #pragma omp parallel
+    {
+        vector< Vertex > &local = threadVertices[ omp_get_thread_num( ) ];
+
+        #pragma omp for schedule(static)
+        for ( int sample = 0; sample < numSamples; sample++ ) {
+            if ( gBuffer.objectIds[ sample ] == GBuffer::NO_OBJECT )
+                continue;
+
+            // Follow the reflections of the camera ray like Scene::shadePhong does
+            unsigned pixel = sample / spp;
+            unsigned sub = sample % spp;
+            Ray ray = scene.cameraRay( pixel % w, pixel / w, sub % ssFactor, sub / ssFactor, h );
+            Hit hit( gBuffer.depths[ sample ], gBuffer.normal( sample ) );
+            Object *obj = scene.objects[ gBuffer.objectIds[ sample ] ].get( );
+            double weight = 1.0;
+            for ( int recDepth = scene.maxRecursionDepth; ; recDepth-- ) {
+                Material const &material = scene.materials[ obj->material ];
+                Point hitPoint = ray.at( hit.t );
+                Color materialColor = material.hasTexture ? scene.surfaceColor< true >( *obj, ray, hit )
+                                                          : scene.surfaceColor< false >( *obj, ray, hit );
+                ShadingClass shading = scene.shadingClass( material );
+                if ( shading == SHADE_FLAT ) {
+                    constant[ sample ] += weight * materialColor;
+                    break;
+                }
+
+                ambient[ sample ] += weight * material.ka * materialColor;
+                local.push_back( Vertex{ hitPoint, hit.N, -ray.D, obj->material, shading != SHADE_DIFFUSE,
+                                         materialColor, weight, (unsigned) sample } );
+
+                double scale;
+                if ( shading != SHADE_REFLECTIVE || recDepth <= 0 || !scene.keepRay( weight * material.ks, scale ) )
+                    break;
+                weight *= material.ks * scale;
+                ray = scene.reflectionRay( hitPoint, hit.N, -ray.D );
+                if ( !scene.hit( ray, hit, obj ) )
+                    break;
+            }
+        }
+    }
+    concat( threadVertices, vertices );
+
+    tracedLights = scene.lights;
+    lightTransfers.assign( tracedLights.size( ), vector< Transfer >( ) );
+    for ( unsigned idx = 0; idx != tracedLights.size( ); ++idx )
+        traceLight( scene, idx );
+}
+
+unsigned Relighter::update( Scene &scene ) {
+    unsigned numTraced = 0;
+    for ( unsigned idx = 0; idx != tracedLights.size( ); ++idx ) {
+        if ( !scene.lights[ idx ]->sameGeometry( *tracedLights[ idx ] ) ) {
+            tracedLights[ idx ] = scene.lights[ idx ];
+            traceLight( scene, idx );
+            numTraced++;
+        }
+    }
+    return numTraced;
+}
+
+void Relighter::traceLight( Scene &scene, unsigned lightIdx ) {
+    Light const &light = *scene.lights[ lightIdx ];
+    Color const white( 1.0, 1.0, 1.0 );
+    int numVertices = vertices.size( );
+    vector< vector< Transfer > > threadTransfers( omp_get_max_threads( ) );
+
+    #pragma omp parallel
+    {
+        vector< Transfer > &local = threadTransfers[ omp_get_thread_num( ) ];
+
+        #pragma omp for schedule(static)
+        for ( int i = 0; i < numVertices; i++ ) {
+            Vertex const &vertex = vertices[ i ];
+            double scale = light.attenuation( ( light.position - vertex.position ).length( ) );
+            if ( scale <= 0 )
+                continue;
+
+            // The same terms as in Scene::shadePhong, for a white light
+            Color diffuse, specular;
+            if ( light.isArea( ) ) {
+                LightSample sample{ lightIdx, scale, 0.0 };
+                if ( scene.hasShadows ) {
+                    if ( vertex.hasSpecular )
+                        scene.areaLightTerms< true, true >( sample, white, vertex.material, vertex.position, vertex.N, vertex.V, diffuse, specular );
+                    else
+                        scene.areaLightTerms< true, false >( sample, white, vertex.material, vertex.position, vertex.N, vertex.V, diffuse, specular );
+                } else {
+                    if ( vertex.hasSpecular )
+                        scene.areaLightTerms< false, true >( sample, white, vertex.material, vertex.position, vertex.N, vertex.V, diffuse, specular );
+                    else
+                        scene.areaLightTerms< false, false >( sample, white, vertex.material, vertex.position, vertex.N, vertex.V, diffuse, specular );
+                }
+            } else {
+                Vector L = ( light.position - vertex.position ).normalized( );
+                float lightDistance = ( light.position - vertex.position ).length( );
+                if ( scene.hasShadows && scene.occluded( scene.shadowRay( vertex.position, L ), lightDistance, lightIdx ) )
+                    continue;
+                if ( vertex.hasSpecular )
+                    scene.lightTerms< true >( white * scale, vertex.material, vertex.N, L, vertex.V, diffuse, specular );
+                else
+                    scene.lightTerms< false >( white * scale, vertex.material, vertex.N, L, vertex.V, diffuse, specular );
+            }
+
+            Color transfer = vertex.weight * ( diffuse * vertex.materialColor + specular );
+            if ( transfer.r > 0 || transfer.g > 0 || transfer.b > 0 )
+                local.push_back( Transfer{ vertex.sample, transfer } );
+        }
+    }
+    concat( threadTransfers, lightTransfers[ lightIdx ] );
+}
+
+void Relighter::resolve( Scene &scene ) const {
+    Color ambientLight = scene.hasAmbientLight ? scene.ambientLight : scene.averageLightColor;
+    vector< Color > samples( constant );
+    for ( size_t i = 0; i < samples.size( ); i++ )
+        samples[ i ] += ambientLight * ambient[ i ];
+    for ( unsigned idx = 0; idx != lightTransfers.size( ); ++idx ) {
+        Color const &lightColor = scene.lights[ idx ]->color;
+        for ( Transfer const &transfer : lightTransfers[ idx ] )
+            samples[ transfer.sample ] += lightColor * transfer.transfer;
+    }
+    scene.resolveSamples( samples );
+}
@@ -0,0 +1,75 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef RELIGHT_H_
+#define RELIGHT_H_
+
+#include "light.h"
+#include "material.h"
+#include "triple.h"
+
+#include <vector>
+
+class Scene;
+
+/**
+ * Light transport of every sample of a render, kept such that the image can
+ * be recomposed for other light colors without tracing any ray.
+ *
+ * Radiance is linear in the color of each light (and the ambient light). So
+ * for every sample it stores the constant part (flat materials), the factor
+ * of the ambient light, and per light the factor of its color ("transfer").
+ * The transfer includes shadowing and all reflections. Only lights that were
+ * moved (or changed shape or range) have to be traced again, and only their
+ * shadow rays: the path vertices along the reflections are kept as well.
+ *
+ * Lights are never culled or sampled by importance here, as that depends on
+ * their colors. Every light that reaches a point is taken into account.
+ */
+class Relighter
+{
+    public:
+        // Traces the paths of all samples in the G-buffer of 'scene', and the
+        // transfer of all lights to them
+        void capture( Scene &scene );
+
+        // Traces the transfer again of the lights of which the geometry has
+        // changed since they were last traced. Returns how many there are
+        unsigned update( Scene &scene );
+
+        // Composes the image from the transfers and the current colors, into
+        // the frame buffer of the scene
+        void resolve( Scene &scene ) const;
+
+    private:
+        // A shaded (non-flat) hit along the path of a sample
+        struct Vertex
+        {
+            Point position;
+            Vector N;
+            Vector V;
+            MaterialId material;
+            bool hasSpecular;
+            Color materialColor;
+            double weight; // Throughput of the path up to this vertex
+            unsigned sample;
+        };
+
+        // Color of a light that reaches 'sample', when the light is white
+        struct Transfer
+        {
+            unsigned sample;
+            Color transfer;
+        };
+
+        std::vector< Vertex > vertices;
+        std::vector< Color > constant;
+        std::vector< Color > ambient;
+        std::vector< std::vector< Transfer > > lightTransfers;
+        // The lights as they were traced. Lights are never modified, only
+        // replaced, so these remain as they were
+        std::vector< LightPtr > tracedLights;
+
+        void traceLight( Scene &scene, unsigned lightIdx );
+};
+
+#endif
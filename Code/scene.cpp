@@ -1,112 +1,484 @@
 #include "scene.h"
 
 #include "image.h"
+#include "imagestream.h"
 #include "material.h"
+#include "wavefront.h"
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
+#include <random>
 
 #include <iostream>
 
+#include <omp.h>
+
 using namespace std;
 
 // A constant value that ensures floating-point errors do not cause problems
 // Mainly used for shadow and reflection rays
 const float SHADOW_BIAS = 1e-4;
 
-bool Scene::hit(Ray const &ray, Hit& dstHit, ObjectPtr& dstObj) {
+bool Scene::hit(Ray const &ray, Hit& dstHit, Object*& dstObj) {
+    unsigned objIdx;
+    if ( !hit( ray, dstHit, objIdx ) )
+        return false;
+
+    dstObj = objects[ objIdx ].get( );
+    return true;
+}
+
+bool Scene::hit(Ray const &ray, Hit& dstHit, unsigned& dstObjIdx) {
     // Find hit object and distance
     Hit min_hit = Hit(numeric_limits<double>::infinity(), Vector());
-    ObjectPtr obj = nullptr;
+    unsigned objIdx = ~0u;
     for (unsigned idx = 0; idx != objects.size(); ++idx)
     {
         Hit hit(objects[idx]->intersect(ray));
         if (hit.t < min_hit.t)
         {
             min_hit = hit;
-            obj = objects[idx];
+            objIdx = idx;
         }
     }
 
-    if ( !obj )
+    if ( objIdx == ~0u )
         return false;
 
     dstHit = min_hit;
-    dstObj = obj;
+    dstObjIdx = objIdx;
 
     return true;
 }
 
-Color Scene::trace(Ray const &ray) {
-    return trace( ray, maxRecursionDepth );
+bool Scene::occluded(Ray const &ray, double maxT, unsigned lightIdx) {
+    // The part of an object that last blocked a shadow ray, per light
+    struct Occluder
+    {
+        unsigned object;
+        unsigned primitive;
+    };
+    thread_local vector< Occluder > cache;
+    if ( cache.size( ) < lights.size( ) )
+        cache.resize( lights.size( ), Occluder{ ~0u, 0 } );
+
+    RenderStats &threadStats = stats( );
+    threadStats.shadowRays++;
+
+    if ( lightIdx < shadowMaps.size( ) && !shadowMaps[ lightIdx ].empty( ) ) {
+        switch ( shadowMaps[ lightIdx ].lookup( ray.O, shadowMapTolerance, shadowMapExactEdges ) ) {
+        case ShadowCubeMap::VISIBLE:
+            threadStats.shadowMapHits++;
+            return false;
+        case ShadowCubeMap::OCCLUDED:
+            threadStats.shadowMapHits++;
+            return true;
+        case ShadowCubeMap::UNKNOWN:
+            break;
+        }
+    }
+
+    // Neighbouring shadow rays are likely blocked by the same primitive
+    Occluder &cached = cache[ lightIdx ];
+    if ( cached.object < objects.size( ) &&
+         objects[ cached.object ]->intersectPrimitive( ray, cached.primitive ).t <= maxT ) {
+        threadStats.occluderCacheHits++;
+        return true;
+    }
+
+    for (unsigned idx = 0; idx != objects.size(); ++idx)
+    {
+        unsigned primitive;
+        if ( objects[ idx ]->occludes( ray, maxT, primitive ) ) {
+            cached = Occluder{ idx, primitive };
+            return true;
+        }
+    }
+    return false;
 }
 
-Color Scene::trace(Ray const &ray, int recDepth)
+template < class Config >
+Color Scene::traceWith(Ray const &ray, int recDepth, double weight)
 {
     Hit min_hit = Hit::NO_HIT( );
-    ObjectPtr obj = nullptr;
+    Object *obj = nullptr;
     // No hit? Return background color.
     if (!hit(ray, min_hit, obj)) return Color(0.0, 0.0, 0.0);
 
-    Material material = obj->material;             //the hit objects material
-    Point hitPoint = ray.at(min_hit.t);                 //the hit point
-    Vector N = min_hit.N;                          //the normal at hit point
+    return shadeHit< Config >( ray, min_hit, *obj, recDepth, weight );
+}
+
+template < class Config >
+Color Scene::shadeHit(Ray const &ray, Hit const &hit, Object &obj, int recDepth, double weight)
+{
+    // Shade with the kernel specialized for the hit objects material
+    switch ( shadeKernels[ obj.material ] ) {
+    case SHADE_FLAT * 2:            return shadeFlat< false >( ray, hit, obj );
+    case SHADE_FLAT * 2 + 1:        return shadeFlat< true >( ray, hit, obj );
+    case SHADE_DIFFUSE * 2:         return shadePhong< Config, false, false, false >( ray, hit, obj, recDepth, weight );
+    case SHADE_DIFFUSE * 2 + 1:     return shadePhong< Config, false, false, true >( ray, hit, obj, recDepth, weight );
+    case SHADE_PHONG * 2:           return shadePhong< Config, true, false, false >( ray, hit, obj, recDepth, weight );
+    case SHADE_PHONG * 2 + 1:       return shadePhong< Config, true, false, true >( ray, hit, obj, recDepth, weight );
+    case SHADE_REFLECTIVE * 2:      return shadePhong< Config, true, true, false >( ray, hit, obj, recDepth, weight );
+    default:                        return shadePhong< Config, true, true, true >( ray, hit, obj, recDepth, weight );
+    }
+}
+
+// --- Shading kernels ---------------------------------------------------------
+// Every material is shaded by the kernel that does only the work it needs
+
+ShadingClass Scene::shadingClass(Material const &material) const
+{
+    if ( material.isFlat )
+        return SHADE_FLAT;
+    if ( material.ks <= 0 )
+        return SHADE_DIFFUSE;
+    if ( maxRecursionDepth == 0 )
+        return SHADE_PHONG;
+    return SHADE_REFLECTIVE;
+}
+
+void Scene::prepareMaterials()
+{
+    shadeKernels.clear( );
+    specularPowers.clear( );
+    for ( Material const &material : materials ) {
+        shadeKernels.push_back( shadingClass( material ) * 2 + ( material.hasTexture ? 1 : 0 ) );
+        specularPowers.push_back( SpecularPower( material.n, exactSpecular ) );
+    }
+
+    // Camera rays pass through the image plane z = 0, which has a pixel per
+    // unit. Every sub-sample covers an equal part of the pixel
+    unsigned int ssFactor = std::max( superSamplingFactor, (unsigned int) 1 );
+    pixelSpread = 1.0 / ( ssFactor * std::max( fabs( eye.z ), 1.0 ) );
+}
+
+// Flat materials have no shading
+template < bool HasTexture >
+Color Scene::shadeFlat(Ray const &ray, Hit const &hit, Object &obj)
+{
+    return surfaceColor< HasTexture >( obj, ray, hit );
+}
+
+template < class Config, bool HasSpecular, bool IsReflective, bool HasTexture >
+Color Scene::shadePhong(Ray const &ray, Hit const &hit, Object &obj, int recDepth, double weight)
+{
+    Material const &material = materials[ obj.material ]; //the hit objects material
+    Point hitPoint = ray.at(hit.t);                     //the hit point
+    Vector N = hit.N;                              //the normal at hit point
     Vector V = -ray.D;                             //the view vector
 
     // Phong color calculation
 
-    Color ambientColor;
+    // Note that the ambient color is chosen as the average of all light sources if
+    // it is not constant/statically defined (as proposed by the lecture slides)
+    Color ambientColor = ( Config::hasAmbientLight ? ambientLight : averageLightColor ) * material.ka;
     Color diffuseColor;
     Color specularColor;
-    for ( LightPtr pLight : lights ) {
-        if ( !hasAmbientLight ) { // If ambient light is not constant/statically defined
-            // Note that the ambient color is chosen as the average of all light sources
-            // (as proposed by the lecture slides)
-            ambientColor += ( pLight->color * material.ka ) / lights.size( );
+    // Only used within the loop below (so before recursing)
+    thread_local vector< LightSample > lightSamples;
+    gatherLights( hitPoint, material, lightSamples );
+    for ( LightSample const &sample : lightSamples ) {
+        Light const &light = *lights[ sample.index ];
+        if ( light.isArea( ) ) {
+            areaLightTerms< Config::hasShadows, HasSpecular >( sample, light.color, obj.material, hitPoint, N, V, diffuseColor, specularColor );
+            continue;
         }
+
         // Normalized vector pointing to the light
-        Vector L = ( pLight->position - hitPoint ).normalized( );
-        float lightDistance = ( pLight->position - hitPoint ).length( );
-
-        Ray shadowRay( hitPoint + L * SHADOW_BIAS, L );
-        Hit shadowHit = Hit::NO_HIT( );
-        ObjectPtr shadowObj = nullptr;
-
-        if ( !hasShadows || !hit( shadowRay, shadowHit, shadowObj ) || shadowHit.t > lightDistance ) {
-          // Mirror of light vector along the surface normal
-          Vector RLight = 2 * L.dot( N ) * N - L;
-          diffuseColor += pLight->color * material.kd * max( 0.0, N.dot( L ) );
-          specularColor += pLight->color * material.ks * pow( max( 0.0, RLight.dot( V ) ), material.n );
+        Vector L = ( light.position - hitPoint ).normalized( );
+        float lightDistance = ( light.position - hitPoint ).length( );
+
+        if ( !Config::hasShadows || !occluded( shadowRay( hitPoint, L ), lightDistance, sample.index ) ) {
+            lightTerms< HasSpecular >( light.color * sample.scale, obj.material, N, L, V, diffuseColor, specularColor );
         }
     }
 
-    if ( hasAmbientLight ) { // Use statically defined ambient light
-        ambientColor = this->ambientLight * material.ka;
+    Color materialColor = surfaceColor< HasTexture >( obj, ray, hit );
+
+    // With a static depth the compiler unrolls the whole chain of reflections
+    bool canRecurse = ( Config::depth == DYNAMIC_DEPTH ? recDepth > 0 : Config::depth > 0 );
+    double scale;
+    if ( IsReflective && canRecurse && keepRay( weight * material.ks, scale ) ) {
+        double ks = material.ks * scale;
+        specularColor += ks * traceWith< typename Config::Child >( reflectionRay( hitPoint, N, V ), recDepth - 1, weight * ks );
     }
 
-    Color materialColor;
-    if ( material.hasTexture ) {
-        Point2 uv = obj->uvMap( hitPoint );
-        materialColor = material.pTexture->colorAt( uv.x, uv.y );
-    } else {
-        materialColor = material.color;
+    // Note that the specular color is unrelated to the material color (as it is a reflection of the light source)
+    return ( ambientColor + diffuseColor ) * materialColor + specularColor;
+}
+
+// --- Shading helpers ---------------------------------------------------------
+// Shared by the recursive tracer above and the wavefront tracer (wavefront.cpp)
+
+// Uniformly distributed random number in [0,1). Every thread has its own generator
+static double uniformRandom( )
+{
+    thread_local minstd_rand rng;
+    return uniform_real_distribution< double >( 0.0, 1.0 )( rng );
+}
+
+void Scene::prepareLights()
+{
+    lightGrid.build( lights );
+
+    averageLightColor = Color( );
+    for ( LightPtr const &pLight : lights )
+        averageLightColor += pLight->color;
+    if ( !lights.empty( ) )
+        averageLightColor /= lights.size( );
+}
+
+void Scene::prepareShadowMaps()
+{
+    if ( !shadowMapFile.empty( ) && loadShadowMaps( shadowMapFile, shadowMapKey, lights.size( ), shadowMaps ) ) {
+        cout << "Loaded shadow maps from " << shadowMapFile << ".\n";
+        return;
     }
 
-    Color color;
-    if ( material.isFlat ) { // Flat materials have no shading
-        color = materialColor;
-    } else { // Non-flat materials do have shading
-        if ( recDepth > 0 && material.ks > 0 ) {
-            Vector REye = 2 * V.dot( N ) * N - V;
-            Ray specularRay( hitPoint + REye * SHADOW_BIAS, REye );
-            specularColor += material.ks * trace( specularRay, recDepth - 1 );
+    cout << "Building shadow maps...\n";
+    auto firstHit = [this]( Ray const &ray ) {
+        Hit hit = Hit::NO_HIT( );
+        Object *obj;
+        return this->hit( ray, hit, obj ) ? hit.t : numeric_limits<double>::infinity( );
+    };
+    shadowMaps.assign( lights.size( ), ShadowCubeMap( ) );
+    for ( unsigned idx = 0; idx != lights.size( ); ++idx ) {
+        if ( !lights[ idx ]->isArea( ) )
+            shadowMaps[ idx ].build( lights[ idx ]->position, shadowMapResolution, firstHit );
+    }
+
+    if ( !shadowMapFile.empty( ) )
+        saveShadowMaps( shadowMapFile, shadowMapKey, shadowMaps );
+}
+
+void Scene::gatherLights(Point const &hitPoint, Material const &material, vector<LightSample> &dst) const
+{
+    dst.clear( );
+    double reflectance = material.kd + material.ks;
+
+    auto consider = [&]( unsigned idx ) {
+        Light const &light = *lights[ idx ];
+        double scale = 1.0;
+        if ( light.isBounded( ) )
+            scale = light.attenuation( ( light.position - hitPoint ).length( ) );
+        double importance = max( max( light.color.r, light.color.g ), light.color.b ) * scale * reflectance;
+        if ( importance > lightCullThreshold )
+            dst.push_back( LightSample{ idx, scale, importance } );
+    };
+
+    for ( unsigned idx : lightGrid.unboundedLights( ) )
+        consider( idx );
+    unsigned const *begin, *end;
+    lightGrid.query( hitPoint, begin, end );
+    for ( unsigned const *it = begin; it != end; ++it )
+        consider( *it );
+
+    if ( lightSamples == 0 || dst.size( ) <= lightSamples )
+        return;
+
+    // Too many lights. Pick 'lightSamples' of them (with replacement) with a
+    // probability proportional to their importance. Each pick is weighted by
+    // 1 / ( lightSamples * probability ), which keeps the estimate unbiased
+    thread_local vector< LightSample > candidates;
+    thread_local vector< double > cdf;
+    candidates.swap( dst );
+    dst.clear( );
+    cdf.clear( );
+    double total = 0;
+    for ( LightSample const &candidate : candidates ) {
+        total += candidate.importance;
+        cdf.push_back( total );
+    }
+    for ( unsigned i = 0; i < lightSamples; i++ ) {
+        size_t pick = lower_bound( cdf.begin( ), cdf.end( ), uniformRandom( ) * total ) - cdf.begin( );
+        LightSample sample = candidates[ min( pick, candidates.size( ) - 1 ) ];
+        sample.scale *= total / ( sample.importance * lightSamples );
+        dst.push_back( sample );
+    }
+}
+
+bool Scene::keepRay(double weight, double &scale) const
+{
+    scale = 1.0;
+    if ( weight >= minRayWeight )
+        return true;
+    if ( !russianRoulette )
+        return false;
+
+    // Survive with a probability proportional to the weight. Survivors are
+    // scaled up, such that the expected contribution remains the same
+    double survival = weight / minRayWeight;
+    if ( uniformRandom( ) >= survival )
+        return false;
+    scale = 1.0 / survival;
+    return true;
+}
+
+template < bool HasSpecular >
+void Scene::lightTerms(Color const &lightColor, MaterialId materialId, Vector const &N,
+                       Vector const &L, Vector const &V, Color &diffuse, Color &specular) const
+{
+    Material const &material = materials[ materialId ];
+    diffuse += lightColor * material.kd * max( 0.0, N.dot( L ) );
+    if ( HasSpecular ) {
+        // Mirror of light vector along the surface normal
+        Vector RLight = 2 * L.dot( N ) * N - L;
+        specular += lightColor * material.ks * specularPowers[ materialId ]( max( 0.0, RLight.dot( V ) ) );
+    }
+}
+
+template void Scene::lightTerms< false >(Color const &, MaterialId, Vector const &,
+                                         Vector const &, Vector const &, Color &, Color &) const;
+template void Scene::lightTerms< true >(Color const &, MaterialId, Vector const &,
+                                        Vector const &, Vector const &, Color &, Color &) const;
+
+template < bool HasShadows, bool HasSpecular >
+void Scene::areaLightTerms(LightSample const &sample, Color const &lightColor, MaterialId materialId, Point const &hitPoint,
+                           Vector const &N, Vector const &V, Color &diffuse, Color &specular)
+{
+    Light const &light = *lights[ sample.index ];
+    RenderStats &threadStats = stats( );
+    threadStats.areaLightPoints++;
+
+    // The light is divided in k x k strata, at most 'maxSamples' of them, and
+    // every shadow ray goes to a random point within a stratum
+    unsigned k = max( 1u, (unsigned) sqrt( (double) light.maxSamples ) );
+    double numStrata = k * k;
+
+    // Casts a shadow ray towards stratum (i,j). Adds its terms if it is visible
+    auto takeSample = [&]( unsigned i, unsigned j, Color &sampleDiffuse, Color &sampleSpecular ) {
+        Point p = light.samplePoint( ( i + uniformRandom( ) ) / k, ( j + uniformRandom( ) ) / k, hitPoint );
+        Vector L = ( p - hitPoint ).normalized( );
+        float lightDistance = ( p - hitPoint ).length( );
+        if ( HasShadows && occluded( shadowRay( hitPoint, L ), lightDistance, sample.index ) )
+            return 0u;
+        lightTerms< HasSpecular >( lightColor * sample.scale, materialId, N, L, V, sampleDiffuse, sampleSpecular );
+        return 1u;
+    };
+
+    if ( k == 1 ) {
+        Color sampleDiffuse, sampleSpecular;
+        takeSample( 0, 0, sampleDiffuse, sampleSpecular );
+        diffuse += sampleDiffuse;
+        specular += sampleSpecular;
+        return;
+    }
+
+    // First probe every quadrant of the light, through a random stratum in
+    // each of the 2x2 blocks of strata (which differ in size if k is odd)
+    unsigned blockStart[] = { 0, ( k + 1 ) / 2, k };
+    unsigned probeI[ 4 ], probeJ[ 4 ];
+    double probeArea[ 4 ];
+    Color probeDiffuse[ 4 ], probeSpecular[ 4 ];
+    unsigned numVisible = 0;
+    for ( unsigned q = 0; q < 4; q++ ) {
+        unsigned bi = q % 2, bj = q / 2;
+        unsigned width = blockStart[ bi + 1 ] - blockStart[ bi ];
+        unsigned height = blockStart[ bj + 1 ] - blockStart[ bj ];
+        probeI[ q ] = blockStart[ bi ] + min( width - 1, (unsigned) ( uniformRandom( ) * width ) );
+        probeJ[ q ] = blockStart[ bj ] + min( height - 1, (unsigned) ( uniformRandom( ) * height ) );
+        probeArea[ q ] = width * height / numStrata;
+        numVisible += takeSample( probeI[ q ], probeJ[ q ], probeDiffuse[ q ], probeSpecular[ q ] );
+    }
+
+    if ( numVisible == 0 || numVisible == 4 || k == 2 ) {
+        // Each probe stands for its block
+        for ( unsigned q = 0; q < 4; q++ ) {
+            diffuse += probeDiffuse[ q ] * probeArea[ q ];
+            specular += probeSpecular[ q ] * probeArea[ q ];
         }
+        return;
+    }
 
-        // Note that the specular color is unrelated to the material color (as it is a reflection of the light source)
-        color = ( ambientColor + diffuseColor ) * materialColor + specularColor;
+    // Only where the probes disagree (in the penumbra) it is sampled densely.
+    // The probes took one stratum each, so every stratum is sampled once
+    threadStats.penumbraPoints++;
+    Color sampleDiffuse, sampleSpecular;
+    for ( unsigned q = 0; q < 4; q++ ) {
+        sampleDiffuse += probeDiffuse[ q ];
+        sampleSpecular += probeSpecular[ q ];
+    }
+    for ( unsigned j = 0; j < k; j++ ) {
+        for ( unsigned i = 0; i < k; i++ ) {
+            bool probed = false;
+            for ( unsigned q = 0; q < 4; q++ )
+                probed = probed || ( probeI[ q ] == i && probeJ[ q ] == j );
+            if ( !probed )
+                takeSample( i, j, sampleDiffuse, sampleSpecular );
+        }
     }
 
-    return color;
+    diffuse += sampleDiffuse / numStrata;
+    specular += sampleSpecular / numStrata;
+}
+
+template void Scene::areaLightTerms< false, false >(LightSample const &, Color const &, MaterialId, Point const &,
+                                                    Vector const &, Vector const &, Color &, Color &);
+template void Scene::areaLightTerms< false, true >(LightSample const &, Color const &, MaterialId, Point const &,
+                                                   Vector const &, Vector const &, Color &, Color &);
+template void Scene::areaLightTerms< true, false >(LightSample const &, Color const &, MaterialId, Point const &,
+                                                   Vector const &, Vector const &, Color &, Color &);
+template void Scene::areaLightTerms< true, true >(LightSample const &, Color const &, MaterialId, Point const &,
+                                                  Vector const &, Vector const &, Color &, Color &);
+
+Color Scene::ambientTerm(Material const &material) const
+{
+    if ( hasAmbientLight ) // Use statically defined ambient light
+        return this->ambientLight * material.ka;
+
+    // Note that the ambient color is otherwise chosen as the average of all light sources
+    // (as proposed by the lecture slides)
+    return averageLightColor * material.ka;
+}
+
+// Surfaces seen at a grazing angle are stretched by at most this factor
+static double const MAX_FOOTPRINT_STRETCH = 5;
+
+template < bool HasTexture >
+Color Scene::surfaceColor(Object &obj, Ray const &ray, Hit const &hit) const
+{
+    Material const &material = materials[ obj.material ];
+    if ( !HasTexture )
+        return material.color;
+
+    Point hitPoint = ray.at( hit.t );
+    Point2 uv = obj.uvMap( hitPoint );
+    if ( textureFilter != Texture::TRILINEAR )
+        return material.pTexture->sample( uv.x, uv.y, 0, textureFilter );
+
+    // Width of the ray cone where it hits the surface. Its size in texture
+    // space follows from the texture coordinates a footprint away along two
+    // tangents. For reflection rays only the last segment is accounted for
+    double cosAngle = std::max( fabs( hit.N.dot( ray.D ) ), 1 / MAX_FOOTPRINT_STRETCH );
+    double footprint = hit.t * pixelSpread / cosAngle;
+    Vector helper = fabs( hit.N.x ) < 0.9 ? Vector( 1, 0, 0 ) : Vector( 0, 1, 0 );
+    Vector tangent = hit.N.cross( helper ).normalized( );
+    Vector bitangent = hit.N.cross( tangent );
+    double uvFootprint = 0;
+    for ( Vector const &offset : { tangent, bitangent } ) {
+        Point2 uvOffset = obj.uvMap( hitPoint + footprint * offset );
+        double du = fabs( uvOffset.x - uv.x );
+        double dv = fabs( uvOffset.y - uv.y );
+        du = std::min( du, 1 - du ); // u wraps around
+        uvFootprint = std::max( uvFootprint, sqrt( du * du + dv * dv ) );
+    }
+    return material.pTexture->sample( uv.x, uv.y, uvFootprint, textureFilter );
+}
+
+template Color Scene::surfaceColor< false >(Object &, Ray const &, Hit const &) const;
+template Color Scene::surfaceColor< true >(Object &, Ray const &, Hit const &) const;
+
+Ray Scene::shadowRay(Point const &hitPoint, Vector const &L) const
+{
+    return Ray( hitPoint + L * SHADOW_BIAS, L );
+}
+
+Ray Scene::reflectionRay(Point const &hitPoint, Vector const &N, Vector const &V) const
+{
+    Vector REye = 2 * V.dot( N ) * N - V;
+    return Ray( hitPoint + REye * SHADOW_BIAS, REye );
 }
 
 void rotate( double &x, double &y, double angle ) {
@@ -119,36 +491,272 @@ void rotate( double &x, double &y, double angle ) {
     y = ny;
 }
 
-void Scene::render(Image &img)
+Ray Scene::cameraRay(unsigned x, unsigned y, unsigned ssX, unsigned ssY, unsigned h) const
+{
+    unsigned int ssFactor = std::max( superSamplingFactor, (unsigned int) 1 );
+    double ssXDisplacement = ( ssX + 1 ) / (double) ( ssFactor + 1 );
+    double ssYDisplacement = ( ssY + 1 ) / (double) ( ssFactor + 1 );
+
+    Point pixel(x + ssXDisplacement, h - 1 - y + ssYDisplacement, 0);
+    Vector rayDir = (pixel - eye).normalized( );
+    rotate(rayDir.y, rayDir.z, eyePitch);
+    return Ray(eye, rayDir);
+}
+
+void Scene::render(Image &img, AovBuffer *aovs)
+{
+    prepareLights( );
+    shadowMaps.clear( );
+    if ( hasShadows && shadowMapResolution > 0 )
+        prepareShadowMaps( );
+    prepareMaterials( );
+    threadStats.assign( omp_get_max_threads( ), ThreadStats( ) );
+
+    frameBuffer.resize( img.width( ), img.height( ) );
+    if ( imageStream )
+        imageStream->beginFrame( frameBuffer );
+    renderFrame( aovs != nullptr );
+    if ( imageStream )
+        imageStream->endFrame( frameBuffer );
+    frameBuffer.toImage( img );
+    if ( aovs )
+        resolveAovs( *aovs );
+}
+
+void Scene::renderFrame(bool needsGBuffer)
+{
+    // Wavefront rendering shades by itself, so then deferred shading needs
+    // no G-buffer (only the AOVs may)
+    bool wavefront = useWavefront && !relightable;
+    if ( needsGBuffer || ( deferredShading && !wavefront ) || relightable ) {
+        visibilityPass( frameBuffer.width( ), frameBuffer.height( ) );
+        if ( !gBufferFile.empty( ) && !gBuffer.write( gBufferFile ) )
+            cerr << "Failed to write G-buffer to " << gBufferFile << ".\n";
+    }
+
+    if ( wavefront ) {
+        Wavefront( *this ).render( frameBuffer );
+        return;
+    }
+
+    if ( relightable ) {
+        relighter.capture( *this );
+        relighter.resolve( *this );
+        return;
+    }
+
+    // Pick the render loop instantiated for the features of this scene
+    if ( hasShadows ) {
+        if ( hasAmbientLight )
+            renderDepth< true, true >( );
+        else
+            renderDepth< true, false >( );
+    } else {
+        if ( hasAmbientLight )
+            renderDepth< false, true >( );
+        else
+            renderDepth< false, false >( );
+    }
+}
+
+template < bool HasShadows, bool HasAmbientLight >
+void Scene::renderDepth()
 {
-    unsigned w = img.width();
-    unsigned h = img.height();
+    switch ( maxRecursionDepth ) {
+    case 0:  renderWith< TraceConfig< HasShadows, HasAmbientLight, 0 > >( ); break;
+    case 1:  renderWith< TraceConfig< HasShadows, HasAmbientLight, 1 > >( ); break;
+    case 2:  renderWith< TraceConfig< HasShadows, HasAmbientLight, 2 > >( ); break;
+    case 3:  renderWith< TraceConfig< HasShadows, HasAmbientLight, 3 > >( ); break;
+    case 4:  renderWith< TraceConfig< HasShadows, HasAmbientLight, 4 > >( ); break;
+    default: renderWith< TraceConfig< HasShadows, HasAmbientLight, DYNAMIC_DEPTH > >( ); break;
+    }
+}
+
+template < class Config >
+void Scene::renderWith()
+{
+    if ( deferredShading ) {
+        shadingPass< Config >( );
+        return;
+    }
+
+    unsigned h = frameBuffer.height();
+    unsigned int ssFactor = std::max( superSamplingFactor, (unsigned int) 1 );
+    int numTiles = frameBuffer.numTiles();
+
+    #pragma omp parallel
+    {
+        FrameBuffer::TileBuffer tile;
+
+        #pragma omp for schedule(dynamic)
+        for (int t = 0; t < numTiles; ++t)
+        {
+            frameBuffer.beginTile(t, tile);
+            for (unsigned y = tile.y0(); y < tile.y1(); ++y)
+            {
+                for (unsigned x = tile.x0(); x < tile.x1(); ++x)
+                {
+                    for ( unsigned int ssY = 0; ssY < ssFactor; ssY++ ) {
+                        for ( unsigned int ssX = 0; ssX < ssFactor; ssX++ ) {
+                            Color col = traceWith< Config >(cameraRay(x, y, ssX, ssY, h), maxRecursionDepth, 1.0);
+                            if ( clampSamples )
+                                col.clamp();
+                            tile.add(x, y, col);
+                        }
+                    }
+                }
+            }
+            frameBuffer.commit(tile);
+        }
+    }
+}
+
+// --- Deferred shading --------------------------------------------------------
+
+// Number of samples shaded together. Within a batch they are grouped by kernel
+static size_t const SHADE_BATCH_SIZE = 4096;
 
+void Scene::visibilityPass(unsigned w, unsigned h)
+{
     unsigned int ssFactor = std::max( superSamplingFactor, (unsigned int) 1 );
+    gBuffer.resize( w, h, ssFactor * ssFactor );
 
     #pragma omp parallel for
     for (unsigned y = 0; y < h; ++y)
     {
+        size_t sample = (size_t) y * w * ssFactor * ssFactor;
         for (unsigned x = 0; x < w; ++x)
         {
-            Color avgCol;
             for ( unsigned int ssY = 0; ssY < ssFactor; ssY++ ) {
-                for ( unsigned int ssX = 0; ssX < ssFactor; ssX++ ) {
-                    double ssXDisplacement = ( ssX + 1 ) / (double) ( ssFactor + 1 );
-                    double ssYDisplacement = ( ssY + 1 ) / (double) ( ssFactor + 1 );
-
-                    Point pixel(x + ssXDisplacement, h - 1 - y + ssYDisplacement, 0);
-                    Vector rayDir = (pixel - eye).normalized( );
-                    rotate(rayDir.y, rayDir.z, eyePitch);
-                    Ray ray(eye, rayDir);
-                    Color col = trace(ray);
-                    col.clamp();
-                    
-                    avgCol += col;
+                for ( unsigned int ssX = 0; ssX < ssFactor; ssX++, sample++ ) {
+                    Ray ray = cameraRay( x, y, ssX, ssY, h );
+                    Hit min_hit = Hit::NO_HIT( );
+                    unsigned objIdx;
+                    if ( !hit( ray, min_hit, objIdx ) ) {
+                        gBuffer.objectIds[ sample ] = GBuffer::NO_OBJECT;
+                        continue;
+                    }
+
+                    Object &obj = *objects[ objIdx ];
+                    Point2 uv = obj.uvMap( ray.at( min_hit.t ) );
+                    gBuffer.objectIds[ sample ] = objIdx;
+                    gBuffer.materialIds[ sample ] = obj.material;
+                    gBuffer.depths[ sample ] = min_hit.t;
+                    gBuffer.setNormal( sample, min_hit.N );
+                    gBuffer.u[ sample ] = (float) uv.x;
+                    gBuffer.v[ sample ] = (float) uv.y;
                 }
             }
-            avgCol /= ssFactor * ssFactor;
-            img(x, y) = avgCol;
+        }
+    }
+}
+
+template < class Config >
+void Scene::shadingPass()
+{
+    unsigned w = gBuffer.width( );
+    unsigned h = gBuffer.height( );
+    unsigned spp = gBuffer.samplesPerPixel( );
+    unsigned int ssFactor = std::max( superSamplingFactor, (unsigned int) 1 );
+    size_t numSamples = gBuffer.size( );
+    vector< Color > samples( numSamples );
+
+    int numBatches = ( numSamples + SHADE_BATCH_SIZE - 1 ) / SHADE_BATCH_SIZE;
+    #pragma omp parallel
+    {
+        // Samples of the batch, sorted by kernel with a counting sort
+        vector< unsigned > order( SHADE_BATCH_SIZE );
+
+        #pragma omp for schedule(dynamic)
+        for ( int batch = 0; batch < numBatches; batch++ ) {
+            size_t begin = batch * SHADE_BATCH_SIZE;
+            size_t end = std::min( begin + SHADE_BATCH_SIZE, numSamples );
+
+            unsigned kernelStart[ 9 ] = { 0 };
+            for ( size_t i = begin; i < end; i++ ) {
+                if ( gBuffer.objectIds[ i ] != GBuffer::NO_OBJECT )
+                    kernelStart[ shadeKernels[ gBuffer.materialIds[ i ] ] + 1 ]++;
+            }
+            for ( int k = 1; k < 9; k++ )
+                kernelStart[ k ] += kernelStart[ k - 1 ];
+            unsigned numHits = kernelStart[ 8 ];
+            for ( size_t i = begin; i < end; i++ ) {
+                if ( gBuffer.objectIds[ i ] != GBuffer::NO_OBJECT )
+                    order[ kernelStart[ shadeKernels[ gBuffer.materialIds[ i ] ] ]++ ] = i;
+                else
+                    samples[ i ] = Color( 0.0, 0.0, 0.0 ); // background
+            }
+
+            for ( unsigned j = 0; j < numHits; j++ ) {
+                size_t i = order[ j ];
+                size_t pixel = i / spp;
+                unsigned sub = i % spp;
+                Ray ray = cameraRay( pixel % w, pixel / w, sub % ssFactor, sub / ssFactor, h );
+                Hit min_hit( gBuffer.depths[ i ], gBuffer.normal( i ) );
+                Object &obj = *objects[ gBuffer.objectIds[ i ] ];
+                samples[ i ] = shadeHit< Config >( ray, min_hit, obj, maxRecursionDepth, 1.0 );
+            }
+        }
+    }
+
+    resolveSamples( samples );
+}
+
+void Scene::resolveAovs(AovBuffer &aovs) const
+{
+    unsigned w = gBuffer.width( );
+    unsigned h = gBuffer.height( );
+    unsigned spp = gBuffer.samplesPerPixel( );
+    // The sub-sample closest to the center of the pixel
+    unsigned ssFactor = std::max( superSamplingFactor, (unsigned int) 1 );
+    unsigned center = ( ssFactor / 2 ) * ssFactor + ssFactor / 2;
+    aovs.resize( w, h );
+
+    #pragma omp parallel for
+    for ( unsigned y = 0; y < h; ++y ) {
+        for ( unsigned x = 0; x < w; ++x ) {
+            size_t pixel = (size_t) y * w + x;
+            size_t sample = pixel * spp + center;
+            uint32_t objIdx = gBuffer.objectIds[ sample ];
+            if ( objIdx == GBuffer::NO_OBJECT ) {
+                aovs.depths[ pixel ] = numeric_limits< float >::infinity( );
+                aovs.normalX[ pixel ] = aovs.normalY[ pixel ] = aovs.normalZ[ pixel ] = 0;
+                aovs.objectIds[ pixel ] = AovBuffer::NO_OBJECT;
+            } else {
+                aovs.depths[ pixel ] = (float) gBuffer.depths[ sample ];
+                aovs.normalX[ pixel ] = gBuffer.normalX[ sample ];
+                aovs.normalY[ pixel ] = gBuffer.normalY[ sample ];
+                aovs.normalZ[ pixel ] = gBuffer.normalZ[ sample ];
+                aovs.objectIds[ pixel ] = objIdx + 1;
+            }
+        }
+    }
+}
+
+void Scene::resolveSamples(vector<Color> const &samples)
+{
+    unsigned spp = gBuffer.samplesPerPixel( );
+    unsigned w = gBuffer.width( );
+    int numTiles = frameBuffer.numTiles( );
+
+    #pragma omp parallel
+    {
+        FrameBuffer::TileBuffer tile;
+
+        #pragma omp for schedule(dynamic)
+        for ( int t = 0; t < numTiles; ++t ) {
+            frameBuffer.beginTile( t, tile );
+            for ( unsigned y = tile.y0( ); y < tile.y1( ); ++y ) {
+                for ( unsigned x = tile.x0( ); x < tile.x1( ); ++x ) {
+                    for ( unsigned i = 0; i < spp; i++ ) {
+                        Color col = samples[ ( (size_t) y * w + x ) * spp + i ];
+                        if ( clampSamples )
+                            col.clamp( );
+                        tile.add( x, y, col );
+                    }
+                }
+            }
+            frameBuffer.commit( tile );
         }
     }
 }
@@ -165,6 +773,17 @@ void Scene::addLight(Light const &light)
     lights.push_back(LightPtr(new Light(light)));
 }
 
+MaterialId Scene::addMaterial(Material const &material)
+{
+    auto it = materialIds.find( material );
+    if ( it != materialIds.end( ) )
+        return it->second;
+    MaterialId id = materials.size( );
+    materials.push_back( material );
+    materialIds.emplace( material, id );
+    return id;
+}
+
 void Scene::setEye(Triple const &position)
 {
     eye = position;
@@ -187,16 +806,124 @@ void Scene::setSuperSamplingFactor( unsigned int factor ) {
     this->superSamplingFactor = factor;
 }
 
+void Scene::setWavefront( bool useWavefront ) {
+    this->useWavefront = useWavefront;
+}
+
+void Scene::setSortSecondaryRays( bool sortSecondaryRays ) {
+    this->sortSecondaryRays = sortSecondaryRays;
+}
+
+void Scene::setMinRayWeight( double minRayWeight ) {
+    this->minRayWeight = minRayWeight;
+}
+
+void Scene::setRussianRoulette( bool russianRoulette ) {
+    this->russianRoulette = russianRoulette;
+}
+
+void Scene::setLightCullThreshold( double threshold ) {
+    this->lightCullThreshold = threshold;
+}
+
+void Scene::setLightSamples( unsigned int numSamples ) {
+    this->lightSamples = numSamples;
+}
+
+void Scene::setShadowMaps( unsigned int resolution, string const &cacheFile, uint64_t key ) {
+    this->shadowMapResolution = resolution;
+    this->shadowMapFile = cacheFile;
+    this->shadowMapKey = key;
+}
+
+void Scene::setShadowMapTolerance( double tolerance, bool exactEdges ) {
+    this->shadowMapTolerance = tolerance;
+    this->shadowMapExactEdges = exactEdges;
+}
+
+void Scene::setDeferredShading( bool deferredShading ) {
+    this->deferredShading = deferredShading;
+}
+
+void Scene::setGBufferFile( string const &filename ) {
+    this->gBufferFile = filename;
+}
+
+void Scene::setClampSamples( bool clampSamples ) {
+    this->clampSamples = clampSamples;
+}
+
+void Scene::setImageStream( ImageStream *stream ) {
+    imageStream = stream;
+}
+
+void Scene::setRelightable( bool relightable ) {
+    this->relightable = relightable;
+}
+
+bool Scene::updateLights( vector<Light> const &newLights ) {
+    if ( newLights.size( ) != lights.size( ) )
+        return false;
+
+    for ( unsigned idx = 0; idx != lights.size( ); ++idx ) {
+        // The shadow map of a moved light is outdated. It falls back to rays
+        if ( idx < shadowMaps.size( ) && !newLights[ idx ].sameGeometry( *lights[ idx ] ) )
+            shadowMaps[ idx ] = ShadowCubeMap( );
+        lights[ idx ] = LightPtr( new Light( newLights[ idx ] ) );
+    }
+    prepareLights( );
+    return true;
+}
+
+unsigned Scene::relight( Image &img, AovBuffer *aovs ) {
+    unsigned numTraced = relighter.update( *this );
+    frameBuffer.clear( );
+    if ( imageStream )
+        imageStream->beginFrame( frameBuffer );
+    relighter.resolve( *this );
+    if ( imageStream )
+        imageStream->endFrame( frameBuffer );
+    frameBuffer.toImage( img );
+    if ( aovs )
+        resolveAovs( *aovs ); // The primary hits do not change
+    return numTraced;
+}
+
+void Scene::setExactSpecular( bool exactSpecular ) {
+    this->exactSpecular = exactSpecular;
+}
+
+void Scene::setTextureFilter( Texture::Filter filter ) {
+    this->textureFilter = filter;
+}
+
 void Scene::setAmbientLight(Color const &color ) {
     hasAmbientLight = true;
     this->ambientLight = color;
 }
 
+void Scene::clearAmbientLight() {
+    hasAmbientLight = false;
+}
+
 unsigned Scene::getNumObject()
 {
     return objects.size();
 }
 
+RenderStats Scene::getStats() const
+{
+    RenderStats total;
+    for ( ThreadStats const &thread : threadStats )
+        total += thread.stats;
+    return total;
+}
+
+RenderStats &Scene::stats()
+{
+    return threadStats[ omp_get_thread_num( ) ].stats;
+}
+
 unsigned Scene::getNumLights()
 {
     return lights.size();
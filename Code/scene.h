@@ -2,43 +2,153 @@
 #define SCENE_H_
 
 #include "light.h"
+#include "material.h"
+#include "aovbuffer.h"
+#include "framebuffer.h"
+#include "gbuffer.h"
+#include "lightgrid.h"
 #include "object.h"
 #include "triple.h"
 #include "hit.h"
 #include "ray.h"
+#include "relight.h"
+#include "shadowmap.h"
+#include "specular.h"
+#include "stats.h"
 
+#include <cstdint>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 // Forward declerations
 class Ray;
 class Image;
+class ImageStream;
+
+// The kind of work needed to shade a material. Each has its own kernel
+enum ShadingClass
+{
+    SHADE_FLAT,         // No lighting at all
+    SHADE_DIFFUSE,      // Ambient and diffuse only
+    SHADE_PHONG,        // Ambient, diffuse and specular highlights
+    SHADE_REFLECTIVE    // Phong and reflection rays
+};
+
+// Marks the recursion depth of a TraceConfig as only known at runtime
+int const DYNAMIC_DEPTH = -1;
+
+// Scene features that are constant during a render. The tracer is
+// instantiated for each combination, so they are never tested per hit.
+// 'Depth' is the remaining recursion depth (or DYNAMIC_DEPTH)
+template < bool Shadows, bool AmbientLight, int Depth >
+struct TraceConfig
+{
+    static bool const hasShadows = Shadows;
+    static bool const hasAmbientLight = AmbientLight;
+    static int const depth = Depth;
+    // Config of the reflection rays spawned by a ray of this config
+    typedef TraceConfig< Shadows, AmbientLight, ( Depth > 0 ? Depth - 1 : Depth ) > Child;
+};
+
+// A light selected for shading a point. Its 'scale' includes the attenuation
+// and, when lights are sampled stochastically, the sampling weight
+struct LightSample
+{
+    unsigned index;
+    double scale;
+    double importance; // Upper bound on its contribution
+};
 
 class Scene
 {
+    // The wavefront tracer shares the scene data and shading helpers
+    friend class Wavefront;
+    // As does relighting
+    friend class Relighter;
+
+    // The scene owns its objects and lights. While rendering they are only
+    // referred to by raw pointer or index, as nothing there shares ownership
     std::vector<ObjectPtr> objects;
     std::vector<LightPtr> lights;   // no ptr needed, but kept for consistency
+    // All distinct materials. Objects refer to them by index. The table is not
+    // modified while rendering, so references into it remain valid
+    std::vector<Material> materials;
+    // Index of every material in the table, to find it when it is added again
+    std::unordered_map<Material, MaterialId, MaterialHash> materialIds;
 
     public:
-        Scene( ): hasAmbientLight( false ) { }
-
-        // trace a ray into the scene and return the color
-        Color trace(Ray const &ray);
+        Scene( ): hasAmbientLight( false ), minRayWeight( 0 ), russianRoulette( false ),
+                  lightCullThreshold( 0 ), lightSamples( 0 ),
+                  shadowMapResolution( 0 ), shadowMapTolerance( 0.001 ), shadowMapExactEdges( true ), shadowMapKey( 0 ),
+                  exactSpecular( false ), textureFilter( Texture::TRILINEAR ), pixelSpread( 0 ), useWavefront( false ), sortSecondaryRays( true ),
+                  deferredShading( false ), clampSamples( true ), imageStream( nullptr ), relightable( false ) { }
 
-        // render the scene to the given image
-        void render(Image &img);
+        // render the scene to the given image. If 'aovs' is given, it is
+        // filled with the depth, normal and object of every pixel
+        void render(Image &img, AovBuffer *aovs = nullptr);
 
 
         void addObject(ObjectPtr obj);
         void addLight(Light const &light);
+        // Returns the id of the material, adding it to the table if no identical one exists
+        MaterialId addMaterial(Material const &material);
         void setEye(Triple const &position);
         void setEyePitch(float eyePitch);
         void setHasShadows(bool hasShadows);
         void setMaxRecursionDepth( unsigned int maxRecursionDepth );
         void setSuperSamplingFactor( unsigned int factor );
+        // Reflection rays that contribute less than this weight to their pixel
+        // are not traced. Zero (the default) traces all of them
+        void setMinRayWeight( double minRayWeight );
+        // Terminate low-weight reflection rays randomly instead of always (unbiased)
+        void setRussianRoulette( bool russianRoulette );
+        // Lights that can contribute at most this much to a point are skipped
+        void setLightCullThreshold( double threshold );
+        // If non-zero, shade with at most this many lights, picked randomly by importance
+        void setLightSamples( unsigned int numSamples );
+        // Answer shadow queries of point lights from cube maps of 'resolution'^2
+        // texels per face (0 disables them). They are read from 'cacheFile' if
+        // that was built for the same 'key', and otherwise built and written to it
+        void setShadowMaps( unsigned int resolution, std::string const &cacheFile, uint64_t key );
+        // Relative distance within which a point counts as lit by the shadow map.
+        // With 'exactEdges', points it cannot decide on get an exact shadow ray
+        void setShadowMapTolerance( double tolerance, bool exactEdges );
+        // Evaluate specular highlights with std::pow instead of the fast evaluators
+        void setExactSpecular( bool exactSpecular );
+        void setTextureFilter( Texture::Filter filter );
         void setAmbientLight(Color const &color );
+        // Use the average light color as ambient light again
+        void clearAmbientLight();
+        // Render with the iterative wavefront tracer instead of the recursive one
+        void setWavefront( bool useWavefront );
+        // Sort reflection rays of a wavefront by direction and origin before tracing them
+        void setSortSecondaryRays( bool sortSecondaryRays );
+        // Render the recursive tracer in two passes: one that stores the primary
+        // hits in a G-buffer, and one that shades them in batches per material kernel
+        void setDeferredShading( bool deferredShading );
+        // If set, the G-buffer of a deferred render is written to this file
+        void setGBufferFile( std::string const &filename );
+        // Clamp samples to [0,1] before averaging them into pixels. Turn off
+        // for high dynamic range output
+        void setClampSamples( bool clampSamples );
+        // Null for none. Rendered (and relit) frames are streamed into it
+        void setImageStream( ImageStream *stream );
+        // Keep the light transport of the next render, such that it can be
+        // relit after changing the lights (see relight)
+        void setRelightable( bool relightable );
+        // Replaces the lights by edited versions of them. Returns false (and
+        // changes nothing) if their number differs
+        bool updateLights( std::vector<Light> const &lights );
+        // Renders the image of a relightable render again for the current
+        // lights. Only the shadow rays of lights that moved are traced. Returns
+        // the number of such lights
+        unsigned relight( Image &img, AovBuffer *aovs = nullptr );
 
         unsigned getNumObject();
         unsigned getNumLights();
+        // Counters of the last render, summed over all threads
+        RenderStats getStats() const;
 
     private:
         Point eye;
@@ -51,9 +161,122 @@ class Scene
         Color ambientLight;
         unsigned int maxRecursionDepth;
         unsigned int superSamplingFactor;
+        // Throughput below which reflection rays are terminated (or played
+        // Russian roulette with)
+        double minRayWeight;
+        bool russianRoulette;
+        double lightCullThreshold;
+        unsigned int lightSamples;
+        LightGrid lightGrid;
+        unsigned int shadowMapResolution;
+        double shadowMapTolerance;
+        bool shadowMapExactEdges;
+        std::string shadowMapFile;
+        uint64_t shadowMapKey;
+        // Visibility per light. Empty for area lights
+        std::vector<ShadowCubeMap> shadowMaps;
+        // Average color of all lights. Used as ambient light if none is set
+        Color averageLightColor;
+        bool exactSpecular;
+        Texture::Filter textureFilter;
+        // Width of the cone of a camera ray, per unit of distance
+        double pixelSpread;
+        bool useWavefront;
+        bool sortSecondaryRays;
+        bool deferredShading;
+        std::string gBufferFile;
+        // Primary hits of the last deferred render
+        GBuffer gBuffer;
+        bool clampSamples;
+        ImageStream *imageStream;
+        bool relightable;
+        Relighter relighter;
+
+        // Counters per thread. Padded, so threads do not share cache lines
+        struct ThreadStats
+        {
+            RenderStats stats;
+            char padding[64];
+        };
+        std::vector<ThreadStats> threadStats;
+        RenderStats &stats();
+
+        bool hit(Ray const &ray, Hit& dstHit, Object*& dstObj);
+        bool hit(Ray const &ray, Hit& dstHit, unsigned& dstObjIdx);
+        // True if anything blocks the shadow ray towards light 'lightIdx' before 'maxT'.
+        // The shadow map of the light is consulted first. Otherwise every thread
+        // first tests the object that blocked the previous ray towards that light
+        bool occluded(Ray const &ray, double maxT, unsigned lightIdx);
+        // Render target of the current render. Threads fill it tile by tile
+        FrameBuffer frameBuffer;
+        // Renders into 'frameBuffer', which is sized already. Fills the
+        // G-buffer first if 'needsGBuffer' (or the render mode needs it)
+        void renderFrame(bool needsGBuffer);
+        // Takes the AOVs from the G-buffer
+        void resolveAovs(AovBuffer &aovs) const;
+        // Render loop for the given scene features. renderDepth picks the
+        // recursion depth, which is static up to 4 reflections
+        template < bool HasShadows, bool HasAmbientLight >
+        void renderDepth();
+        template < class Config >
+        void renderWith();
+        // 'weight' is the throughput of the ray: how much it contributes to its pixel
+        template < class Config >
+        Color traceWith(Ray const &ray, int recDepth, double weight);
+        // Shades a hit with the kernel of the object's material
+        template < class Config >
+        Color shadeHit(Ray const &ray, Hit const &hit, Object &obj, int recDepth, double weight);
+
+        // Deferred shading. The visibility pass fills 'gBuffer' with the
+        // primary hits of a w x h image, which the shading pass turns into pixels
+        void visibilityPass(unsigned w, unsigned h);
+        template < class Config >
+        void shadingPass();
+        // Adds the samples (ordered as in the G-buffer) to the frame buffer
+        void resolveSamples(std::vector<Color> const &samples);
+
+        // Primary ray through sub-sample (ssX,ssY) of pixel (x,y) of an image with height h
+        Ray cameraRay(unsigned x, unsigned y, unsigned ssX, unsigned ssY, unsigned h) const;
+        Ray shadowRay(Point const &hitPoint, Vector const &L) const;
+        Ray reflectionRay(Point const &hitPoint, Vector const &N, Vector const &V) const;
+
+        // Builds the light grid and light averages. Called before rendering
+        void prepareLights();
+        void prepareShadowMaps();
+        // Fills 'dst' with the lights that (may) contribute to the point
+        void gatherLights(Point const &hitPoint, Material const &material, std::vector<LightSample> &dst) const;
+
+        // Returns false if a reflection ray of throughput 'weight' should not be
+        // traced. Otherwise its contribution must be multiplied by 'scale'
+        bool keepRay(double weight, double &scale) const;
+        // Kernel per material (2 * ShadingClass + 1 if textured), specialized
+        // for the work the material needs
+        std::vector<unsigned char> shadeKernels;
+        // Evaluator of the specular exponent per material
+        std::vector<SpecularPower> specularPowers;
+
+        ShadingClass shadingClass(Material const &material) const;
+        // Picks the shading kernel of every material. Called before rendering
+        void prepareMaterials();
+        template < bool HasTexture >
+        Color shadeFlat(Ray const &ray, Hit const &hit, Object &obj);
+        template < class Config, bool HasSpecular, bool IsReflective, bool HasTexture >
+        Color shadePhong(Ray const &ray, Hit const &hit, Object &obj, int recDepth, double weight);
 
-        bool hit(Ray const &ray, Hit& dstHit, ObjectPtr& dstObj);
-        Color trace(Ray const &ray, int recDepth);
+        // Adds the Phong diffuse and (if HasSpecular) specular terms of a single unoccluded light
+        template < bool HasSpecular >
+        void lightTerms(Color const &lightColor, MaterialId materialId, Vector const &N,
+                        Vector const &L, Vector const &V, Color &diffuse, Color &specular) const;
+        // Adds the diffuse and specular terms of an area light, averaged over
+        // stratified sample points on it. It starts with a probe per quadrant,
+        // and only samples densely if some of those are occluded and some are not
+        template < bool HasShadows, bool HasSpecular >
+        void areaLightTerms(LightSample const &sample, Color const &lightColor, MaterialId materialId, Point const &hitPoint,
+                            Vector const &N, Vector const &V, Color &diffuse, Color &specular);
+        Color ambientTerm(Material const &material) const;
+        // Texture (if HasTexture) or base color of the object's material at the hit point
+        template < bool HasTexture >
+        Color surfaceColor(Object &obj, Ray const &ray, Hit const &hit) const;
 };
 
 #endif
@@ -0,0 +1,179 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#include "shadowmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+
+#include <unistd.h>
+
+using namespace std;
+
+// Identifies shadow map files, followed by a format version
+static char const MAGIC[4] = { 'R', 'T', 'S', 'M' };
+static uint32_t const VERSION = 1;
+
+ShadowCubeMap::ShadowCubeMap( )
+    : resolution( 0 ) {
+}
+
+void ShadowCubeMap::build( Point const &center, unsigned resolution, FirstHit const &firstHit ) {
+    this->center = center;
+    this->resolution = resolution;
+    depths.assign( 6 * resolution * resolution, 0.0f );
+
+    int numTexels = depths.size( );
+    #pragma omp parallel for schedule(dynamic, 256)
+    for ( int i = 0; i < numTexels; i++ ) {
+        unsigned face = i / ( resolution * resolution );
+        unsigned x = i % resolution;
+        unsigned y = ( i / resolution ) % resolution;
+        Ray ray( center, texelDirection( face, x, y ) );
+        depths[ i ] = (float) firstHit( ray );
+    }
+}
+
+bool ShadowCubeMap::empty( ) const {
+    return resolution == 0;
+}
+
+ShadowCubeMap::Visibility ShadowCubeMap::lookup( Point const &p, double tolerance, bool exactEdges ) const {
+    Vector d = p - center;
+    double dist = d.length( );
+    if ( dist == 0 )
+        return UNKNOWN;
+
+    // The face is that of the major axis. The other two axes span it
+    int axis = 0;
+    for ( int i = 1; i < 3; i++ ) {
+        if ( fabs( d.data[ i ] ) > fabs( d.data[ axis ] ) )
+            axis = i;
+    }
+    unsigned face = 2 * axis + ( d.data[ axis ] < 0 ? 1 : 0 );
+    double major = fabs( d.data[ axis ] );
+    double u = d.data[ ( axis + 1 ) % 3 ] / major;
+    double v = d.data[ ( axis + 2 ) % 3 ] / major;
+
+    // The four texels around the point. Near a seam of the cube they would
+    // be on different faces, so leave those to an exact ray
+    double fx = ( u + 1 ) / 2 * resolution - 0.5;
+    double fy = ( v + 1 ) / 2 * resolution - 0.5;
+    int x0 = (int) floor( fx );
+    int y0 = (int) floor( fy );
+    if ( x0 < 0 || y0 < 0 || x0 + 1 >= (int) resolution || y0 + 1 >= (int) resolution ) {
+        if ( exactEdges )
+            return UNKNOWN;
+        x0 = min( max( x0, 0 ), (int) resolution - 2 );
+        y0 = min( max( y0, 0 ), (int) resolution - 2 );
+    }
+
+    // Lit if on the surface of every texel. Occluded if clearly further
+    // than all of them, which are closer to each other than to the point.
+    // Anything in between is undecided: near a silhouette, or in front of all
+    // texels, the point may be on something they missed (e.g. an edge
+    // passing between them)
+    unsigned numVisible = 0; // At most as far as the surface
+    unsigned numOnSurface = 0;
+    unsigned numOccluded = 0;
+    double nearest = numeric_limits< double >::infinity( );
+    double farthest = 0;
+    for ( int y = y0; y <= y0 + 1; y++ ) {
+        for ( int x = x0; x <= x0 + 1; x++ ) {
+            double depth = depths[ ( face * resolution + y ) * resolution + x ];
+            nearest = min( nearest, depth );
+            farthest = max( farthest, depth );
+            if ( dist <= depth * ( 1 + tolerance ) ) {
+                numVisible++;
+                if ( dist >= depth * ( 1 - tolerance ) )
+                    numOnSurface++;
+            } else if ( dist > depth * ( 1 + 2 * tolerance ) ) {
+                numOccluded++;
+            }
+        }
+    }
+
+    if ( numOnSurface == 4 )
+        return VISIBLE;
+    if ( numOccluded == 4 && farthest - nearest < dist - farthest )
+        return OCCLUDED;
+    if ( !exactEdges ) // Majority vote
+        return numVisible >= 2 ? VISIBLE : OCCLUDED;
+    return UNKNOWN;
+}
+
+Vector ShadowCubeMap::texelDirection( unsigned face, unsigned x, unsigned y ) const {
+    int axis = face / 2;
+    Vector d;
+    d.data[ axis ] = ( face % 2 == 0 ) ? 1 : -1;
+    d.data[ ( axis + 1 ) % 3 ] = ( x + 0.5 ) / resolution * 2 - 1;
+    d.data[ ( axis + 2 ) % 3 ] = ( y + 0.5 ) / resolution * 2 - 1;
+    return d.normalized( );
+}
+
+void ShadowCubeMap::write( ostream &os ) const {
+    os.write( (char const *) &resolution, sizeof resolution );
+    if ( empty( ) )
+        return;
+    os.write( (char const *) center.data, sizeof center.data );
+    os.write( (char const *) depths.data( ), depths.size( ) * sizeof( float ) );
+}
+
+bool ShadowCubeMap::read( istream &is ) {
+    is.read( (char *) &resolution, sizeof resolution );
+    depths.clear( );
+    if ( !is || empty( ) )
+        return (bool) is;
+    is.read( (char *) center.data, sizeof center.data );
+    depths.resize( 6 * resolution * resolution );
+    is.read( (char *) depths.data( ), depths.size( ) * sizeof( float ) );
+    return (bool) is;
+}
+
+void saveShadowMaps( string const &filename, uint64_t key, vector< ShadowCubeMap > const &maps ) {
+    // Written aside and renamed, so the file is never seen partially written
+    // (by another render, or after a crash)
+    string tempName = filename + ".tmp." + to_string( getpid( ) );
+    ofstream file( tempName, ios::binary );
+    if ( !file )
+        return;
+
+    uint32_t numMaps = maps.size( );
+    file.write( MAGIC, sizeof MAGIC );
+    file.write( (char const *) &VERSION, sizeof VERSION );
+    file.write( (char const *) &key, sizeof key );
+    file.write( (char const *) &numMaps, sizeof numMaps );
+    for ( ShadowCubeMap const &map : maps )
+        map.write( file );
+    file.close( );
+    if ( file.fail( ) || rename( tempName.c_str( ), filename.c_str( ) ) != 0 )
+        unlink( tempName.c_str( ) );
+}
+
+bool loadShadowMaps( string const &filename, uint64_t key, size_t numLights, vector< ShadowCubeMap > &maps ) {
+    ifstream file( filename, ios::binary );
+    if ( !file )
+        return false;
+
+    char magic[4];
+    uint32_t version, numMaps;
+    uint64_t fileKey;
+    file.read( magic, sizeof magic );
+    file.read( (char *) &version, sizeof version );
+    file.read( (char *) &fileKey, sizeof fileKey );
+    file.read( (char *) &numMaps, sizeof numMaps );
+    if ( !file || memcmp( magic, MAGIC, sizeof MAGIC ) != 0 || version != VERSION ||
+         fileKey != key || numMaps != numLights )
+        return false;
+
+    maps.assign( numMaps, ShadowCubeMap( ) );
+    for ( ShadowCubeMap &map : maps ) {
+        if ( !map.read( file ) )
+            return false;
+    }
+    return true;
+}
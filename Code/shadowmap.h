@@ -0,0 +1,71 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef SHADOWMAP_H_
+#define SHADOWMAP_H_
+
+#include "ray.h"
+#include "triple.h"
+
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/**
+ * Precomputed visibility of a static point light.
+ *
+ * For every texel of a cube map around the light it stores the distance to
+ * the first surface seen from the light in that direction. A point is lit if
+ * it is (about) as far from the light as the surface in its direction. Near
+ * edges, where the four texels around the point do not agree, or when the
+ * distances are too close to call, it cannot be decided. Then an exact shadow
+ * ray must be cast.
+ */
+class ShadowCubeMap
+{
+    public:
+        enum Visibility
+        {
+            VISIBLE,
+            OCCLUDED,
+            UNKNOWN
+        };
+
+        // Returns the distance to the first hit of the ray (infinity if none)
+        typedef std::function< double( Ray const & ) > FirstHit;
+
+        ShadowCubeMap( );
+
+        // Casts 6 * resolution^2 rays from 'center'
+        void build( Point const &center, unsigned resolution, FirstHit const &firstHit );
+
+        bool empty( ) const;
+
+        // 'tolerance' is the relative difference in distance below which a
+        // point counts as being on the surface seen from the light. Without
+        // 'exactEdges' undecided points are settled by the texels' majority
+        // vote, so it never returns UNKNOWN
+        Visibility lookup( Point const &p, double tolerance, bool exactEdges ) const;
+
+        void write( std::ostream &os ) const;
+        bool read( std::istream &is );
+
+    private:
+        Point center;
+        unsigned resolution;
+        // Face-major, then row-major per face
+        std::vector< float > depths;
+
+        Vector texelDirection( unsigned face, unsigned x, unsigned y ) const;
+};
+
+// Writes the maps of all lights (empty ones for lights without a map) to
+// 'filename'. 'key' identifies the scene they were built for
+void saveShadowMaps( std::string const &filename, uint64_t key, std::vector< ShadowCubeMap > const &maps );
+
+// Reads the maps from 'filename'. Returns false if the file does not exist or
+// was built for another scene (key) or number of lights
+bool loadShadowMaps( std::string const &filename, uint64_t key, size_t numLights, std::vector< ShadowCubeMap > &maps );
+
+#endif
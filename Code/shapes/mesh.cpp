@@ -1,10 +1,11 @@
 /* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
 
 #include "mesh.h"
-#include "../objloader.h"
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <limits>
 
 using namespace std;
 
@@ -43,58 +44,132 @@ bool AABB::intersects( Ray const &ray ) {
   return tMax > 0 && tMin < tMax;
 }
 
-/** Extracts the location from the vertex */
-Point toPoint( Vertex v ) {
-      return Point( v.x, v.y, v.z );
-}
-
 Hit Mesh::intersect( const Ray& ray ) {
-    if ( triangles.size( ) == 0 || !aabb.intersects( ray ) )
+    if ( numTriangles( ) == 0 || !aabb.intersects( ray ) )
         return Hit::NO_HIT( );
 
     // Look for the triangle closest to the camera that intersects with the ray.
-    Hit h = triangles[ 0 ].intersect( ray );
-    for ( unsigned int i = 1; i < triangles.size( ); i++ ) {
-        Hit newH = triangles[ i ].intersect( ray );
-        
-        if ( isnan( h.t ) || h.t <= 0 || ( newH.t < h.t && newH.t > 0 ) ) {
-            h = newH;
+    // Of equally close triangles the first is taken, in whatever order the
+    // nodes are visited
+    Vector invD( 1.0 / ray.D.x, 1.0 / ray.D.y, 1.0 / ray.D.z );
+    MeshFile::Node const *nodes = model->nodes( );
+    Hit h = Hit::NO_HIT( );
+    double closestT = numeric_limits< double >::infinity( );
+    unsigned closest = 0;
+
+    // Nodes to visit, with the distance to their bounds
+    struct Entry { uint32_t node; double distance; };
+    Entry stack[ MeshFile::MAX_DEPTH + 1 ];
+    unsigned stackSize = 0;
+    stack[ stackSize++ ] = Entry{ 0, nodeDistance( nodes[ 0 ], ray, invD ) };
+    while ( stackSize > 0 ) {
+        Entry entry = stack[ --stackSize ];
+        if ( entry.distance > closestT )
+            continue;
+
+        MeshFile::Node const &node = nodes[ entry.node ];
+        if ( node.count == 0 ) {
+            // The nearer child is visited first, as it may hide the other
+            Entry first{ entry.node + 1, nodeDistance( nodes[ entry.node + 1 ], ray, invD ) };
+            Entry second{ node.offset, nodeDistance( nodes[ node.offset ], ray, invD ) };
+            if ( second.distance < first.distance )
+                swap( first, second );
+            if ( second.distance <= closestT )
+                stack[ stackSize++ ] = second;
+            if ( first.distance <= closestT )
+                stack[ stackSize++ ] = first;
+            continue;
         }
-    }
-
-    if ( h.t <= 0 )
-        return Hit::NO_HIT( );
 
+        for ( unsigned i = node.offset; i < node.offset + node.count; i++ ) {
+            Hit newH = intersectTriangle( ray, i );
+            if ( newH.t > 0 && ( newH.t < closestT || ( newH.t == closestT && i < closest ) ) ) {
+                h = newH;
+                closestT = newH.t;
+                closest = i;
+            }
+        }
+    }
     return h;
 }
 
-Mesh::Mesh( Point const &position, double scale, const std::string& filepath ) {
-    OBJLoader objLoader( filepath );
-    std::vector<Vertex> vertexData = objLoader.vertex_data( );
-
-    double minX = std::numeric_limits<double>::infinity( );
-    double minY = std::numeric_limits<double>::infinity( );
-    double minZ = std::numeric_limits<double>::infinity( );
-    double maxX = -std::numeric_limits<double>::infinity( );
-    double maxY = -std::numeric_limits<double>::infinity( );
-    double maxZ = -std::numeric_limits<double>::infinity( );
-
-    // Note that the position and scale are currently applied directly to the vertices
-    // Keep it like this for now, as it is faster to do it here. Though it is less flexible.
-    for ( unsigned int i = 0; i < vertexData.size( ); i += 3 ) {
-        Point p1 = position + toPoint( vertexData[ i ] ) * scale;
-        Point p2 = position + toPoint( vertexData[ i + 1 ] ) * scale;
-        Point p3 = position + toPoint( vertexData[ i + 2 ] ) * scale;
-        Triangle t( p1, p2, p3 );
-        triangles.push_back( t );
-
-        minX = min( min( minX, p1.x ), min( p2.x, p3.x ) );
-        minY = min( min( minY, p1.y ), min( p2.y, p3.y ) );
-        minZ = min( min( minZ, p1.z ), min( p2.z, p3.z ) );
-        maxX = max( max( maxX, p1.x ), max( p2.x, p3.x ) );
-        maxY = max( max( maxY, p1.y ), max( p2.y, p3.y ) );
-        maxZ = max( max( maxZ, p1.z ), max( p2.z, p3.z ) );
+bool Mesh::occludes( Ray const &ray, double maxT, unsigned &primitive ) {
+    if ( numTriangles( ) == 0 || !aabb.intersects( ray ) )
+        return false;
+
+    // Any triangle will do, it does not need to be the closest
+    Vector invD( 1.0 / ray.D.x, 1.0 / ray.D.y, 1.0 / ray.D.z );
+    MeshFile::Node const *nodes = model->nodes( );
+    uint32_t stack[ MeshFile::MAX_DEPTH + 1 ];
+    unsigned stackSize = 0;
+    stack[ stackSize++ ] = 0;
+    while ( stackSize > 0 ) {
+        uint32_t index = stack[ --stackSize ];
+        MeshFile::Node const &node = nodes[ index ];
+        if ( nodeDistance( node, ray, invD ) > maxT )
+            continue;
+
+        if ( node.count == 0 ) {
+            stack[ stackSize++ ] = node.offset;
+            stack[ stackSize++ ] = index + 1;
+            continue;
+        }
+
+        for ( unsigned i = node.offset; i < node.offset + node.count; i++ ) {
+            Hit h = intersectTriangle( ray, i );
+            if ( h.t > 0 && h.t <= maxT ) {
+                primitive = i;
+                return true;
+            }
+        }
     }
+    return false;
+}
+
+Hit Mesh::intersectPrimitive( Ray const &ray, unsigned primitive ) {
+    return intersectTriangle( ray, primitive );
+}
+
+unsigned Mesh::numTriangles( ) const {
+    return model->numTriangles( );
+}
+
+Point Mesh::vertex( uint32_t index ) const {
+    // As position + Point( v ) * scale, without the calls
+    float const *v = &vertices[ 3 * size_t( index ) ];
+    return Point( position.x + v[ 0 ] * scale, position.y + v[ 1 ] * scale, position.z + v[ 2 ] * scale );
+}
+
+Hit Mesh::intersectTriangle( Ray const &ray, unsigned triangle ) const {
+    uint32_t const *corners = &indices[ 3 * size_t( triangle ) ];
+    return Triangle::intersect( vertex( corners[ 0 ] ), vertex( corners[ 1 ] ), vertex( corners[ 2 ] ), ray );
+}
+
+double Mesh::nodeDistance( MeshFile::Node const &node, Ray const &ray, Vector const &invD ) const {
+    // As AABB::intersects, but touching the bounds counts (as flat nodes do)
+    double tX1 = ( position.x + node.lowBound[ 0 ] * scale - ray.O.x ) * invD.x;
+    double tX2 = ( position.x + node.uppBound[ 0 ] * scale - ray.O.x ) * invD.x;
+    double tY1 = ( position.y + node.lowBound[ 1 ] * scale - ray.O.y ) * invD.y;
+    double tY2 = ( position.y + node.uppBound[ 1 ] * scale - ray.O.y ) * invD.y;
+    double tZ1 = ( position.z + node.lowBound[ 2 ] * scale - ray.O.z ) * invD.z;
+    double tZ2 = ( position.z + node.uppBound[ 2 ] * scale - ray.O.z ) * invD.z;
+
+    double tMin = max( max( min( tX1, tX2 ), min( tY1, tY2 ) ), min( tZ1, tZ2 ) );
+    double tMax = min( min( max( tX1, tX2 ), max( tY1, tY2 ) ), max( tZ1, tZ2 ) );
+    if ( tMax < 0 || tMin > tMax )
+        return numeric_limits< double >::infinity( );
+    return tMin;
+}
 
-    aabb = AABB( Point( minX, minY, minZ ), Point( maxX, maxY, maxZ ) );
+Mesh::Mesh( Point const &position, double scale, const std::string& filepath )
+    : position( position ), scale( scale ), model( MeshFile::open( filepath ) ),
+      vertices( model->vertices( ) ), indices( model->indices( ) ) {
+    // The position and scale are applied to the vertices whenever they are
+    // used, so the bounds are placed the same way
+    float const *low = model->lowBound( );
+    float const *upp = model->uppBound( );
+    Point p1( position.x + low[ 0 ] * scale, position.y + low[ 1 ] * scale, position.z + low[ 2 ] * scale );
+    Point p2( position.x + upp[ 0 ] * scale, position.y + upp[ 1 ] * scale, position.z + upp[ 2 ] * scale );
+    aabb = AABB( Point( min( p1.x, p2.x ), min( p1.y, p2.y ), min( p1.z, p2.z ) ),
+                 Point( max( p1.x, p2.x ), max( p1.y, p2.y ), max( p1.z, p2.z ) ) );
 }
@@ -5,6 +5,10 @@
 
 #include "../object.h"
 #include "./triangle.h"
+#include "../meshfile.h"
+
+#include <cstdint>
+#include <memory>
 
 /**
  * Axis-aligned bounding box.
@@ -29,16 +33,38 @@ private:
 
 /**
  * A Mesh is a collection of triangles that share the same material.
+ *
+ * Its model is a MeshFile: float vertices in model space, that are shared by
+ * the triangles, three 32-bit vertex indices per triangle and a bounding
+ * volume hierarchy over them. Vertices and bounds are placed in the scene
+ * when they are intersected, so the model is used as loaded (or mapped).
  */
 class Mesh: public Object {
     public:
+        // Models are read through MeshFile::open, so an OBJ file is cached
+        // in an .rtm file next to it
         Mesh( Point const &position, double scale, const std::string& filepath );
 
         virtual Hit intersect(Ray const &ray);
+        virtual bool occludes(Ray const &ray, double maxT, unsigned &primitive);
+        virtual Hit intersectPrimitive(Ray const &ray, unsigned primitive);
 
     private:
         AABB aabb;
-        std::vector< Triangle > triangles;
+        Point position;
+        double scale;
+        std::shared_ptr< MeshFile const > model;
+        // Of the model: x, y and z per vertex, three indices per triangle
+        float const *vertices;
+        uint32_t const *indices;
+
+        unsigned numTriangles( ) const;
+        // Vertex in the scene
+        Point vertex( uint32_t index ) const;
+        Hit intersectTriangle( Ray const &ray, unsigned triangle ) const;
+        // Distance along the ray to the bounds of the node in the scene,
+        // infinite if it misses them. 'invD' is 1 / ray.D per component
+        double nodeDistance( MeshFile::Node const &node, Ray const &ray, Vector const &invD ) const;
 };
 
 #endif
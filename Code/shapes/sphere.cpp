@@ -2,6 +2,7 @@
 
 #include "sphere.h"
 
+#include <algorithm>
 #include <cmath>
 
 using namespace std;
@@ -51,7 +52,8 @@ Point2 Sphere::uvMap( Point p ) {
     rotate( x, y, rotation.z );
 
     double u = 0.5 + atan2( x, z ) / ( 2 * M_PI );
-    double v = acos( y ) / M_PI;
+    // Points slightly off the surface may exceed the range of acos
+    double v = acos( std::max( -1.0, std::min( y, 1.0 ) ) ) / M_PI;
     return Point2( u, v );
 }
 
@@ -24,6 +24,11 @@ static bool isApproxLeftOf( Point const &v0, Point const &v1, Vector const &N, P
 
 
 Hit Triangle::intersect(Ray const &ray)
+{
+    return intersect( v0, v1, v2, ray );
+}
+
+Hit Triangle::intersect(Point const &v0, Point const &v1, Point const &v2, Ray const &ray)
 {
     Vector N = ( v1 - v0 ).cross( v2 - v0 );
 
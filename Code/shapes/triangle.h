@@ -15,6 +15,11 @@ class Triangle: public Object
 
         virtual Hit intersect(Ray const &ray);
 
+        // Intersection with the triangle of the given points, which are
+        // clockwise around its natural normal. Meshes use this directly on
+        // their shared vertices
+        static Hit intersect(Point const &v0, Point const &v1, Point const &v2, Ray const &ray);
+
     private:
         // These points are always defined clockwise, along their natural normal
         // (this is assured by the constructor)
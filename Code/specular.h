@@ -0,0 +1,98 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef SPECULAR_H_
+#define SPECULAR_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+ * Evaluates x^n for 0 <= x <= 1, with the exponent 'n' of a material.
+ *
+ * The way of evaluating is chosen once per material. Integer exponents use
+ * repeated squaring. Other exponents (of at least 2) linearly interpolate a
+ * table of x^n, which is sized such that the absolute error stays below
+ * MAX_TABLE_ERROR. That is far below an 8-bit step of the output. The exact
+ * (std::pow) path can be forced to compare against.
+ */
+class SpecularPower
+{
+    public:
+        explicit SpecularPower(double n = 0, bool exact = false)
+        :
+            n(n),
+            integerExp(0)
+        {
+            if (exact || n < 2)
+                mode = EXACT;
+            else if (n == std::floor(n) && n <= MAX_INTEGER_EXP)
+            {
+                mode = INTEGER;
+                integerExp = static_cast<unsigned>(n);
+            }
+            else
+            {
+                mode = TABLE;
+                buildTable();
+            }
+        }
+
+        double operator()(double x) const
+        {
+            switch (mode)
+            {
+                case INTEGER:
+                    return integerPow(x);
+                case TABLE:
+                {
+                    double pos = std::min(x, 1.0) * (table.size() - 1);
+                    size_t idx = std::min(static_cast<size_t>(pos), table.size() - 2);
+                    double frac = pos - idx;
+                    return table[idx] + frac * (table[idx + 1] - table[idx]);
+                }
+                default:
+                    return std::pow(x, n);
+            }
+        }
+
+    private:
+        // Larger integer exponents take more squarings than std::pow costs
+        static constexpr double MAX_INTEGER_EXP = 256;
+        static constexpr double MAX_TABLE_ERROR = 1e-4;
+        // Enough for exponents up to about 3600
+        static constexpr size_t MAX_TABLE_SIZE = 1 << 17;
+
+        enum Mode { EXACT, INTEGER, TABLE };
+
+        Mode mode;
+        double n;
+        unsigned integerExp;
+        // x^n at evenly spaced x in [0,1]
+        std::vector<double> table;
+
+        double integerPow(double x) const
+        {
+            double result = 1.0;
+            for (unsigned e = integerExp; e != 0; e >>= 1)
+            {
+                if (e & 1)
+                    result *= x;
+                x *= x;
+            }
+            return result;
+        }
+
+        void buildTable()
+        {
+            // Linear interpolation with spacing h is off by at most
+            // h^2 / 8 * max|f''|, where f''(x) = n (n-1) x^(n-2) <= n (n-1)
+            double intervals = std::ceil(std::sqrt(n * (n - 1) / (8 * MAX_TABLE_ERROR)));
+            size_t size = std::min(static_cast<size_t>(intervals), MAX_TABLE_SIZE - 1) + 1;
+            table.resize(size);
+            for (size_t i = 0; i < size; i++)
+                table[i] = std::pow(static_cast<double>(i) / (size - 1), n);
+        }
+};
+
+#endif
@@ -0,0 +1,51 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <ostream>
+
+/**
+ * Counters gathered while rendering. Every thread has its own copy, which
+ * are summed once rendering is done.
+ */
+struct RenderStats
+{
+    unsigned long shadowRays = 0;
+    // Shadow rays that were blocked by the cached occluder of their light
+    unsigned long occluderCacheHits = 0;
+    // Shadow queries answered by the shadow map of their light, without a ray
+    unsigned long shadowMapHits = 0;
+    // Points shaded by an area light, and those of them in its penumbra
+    unsigned long areaLightPoints = 0;
+    unsigned long penumbraPoints = 0;
+
+    RenderStats &operator+=( RenderStats const &o )
+    {
+        shadowRays += o.shadowRays;
+        occluderCacheHits += o.occluderCacheHits;
+        shadowMapHits += o.shadowMapHits;
+        areaLightPoints += o.areaLightPoints;
+        penumbraPoints += o.penumbraPoints;
+        return *this;
+    }
+
+    void print( std::ostream &os ) const
+    {
+        os << "Shadow rays: " << shadowRays << '\n';
+        if ( shadowRays > 0 ) {
+            os << "Occluder cache hits: " << occluderCacheHits << " ("
+               << ( 100.0 * occluderCacheHits / shadowRays ) << "%)\n";
+            if ( shadowMapHits > 0 ) {
+                os << "Shadow map hits: " << shadowMapHits << " ("
+                   << ( 100.0 * shadowMapHits / shadowRays ) << "%)\n";
+            }
+        }
+        if ( areaLightPoints > 0 ) {
+            os << "Area light points: " << areaLightPoints << ", sampled densely in penumbra: "
+               << penumbraPoints << " (" << ( 100.0 * penumbraPoints / areaLightPoints ) << "%)\n";
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,257 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#include "texture.h"
+
+#include "lode/lodepng.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static uint32_t const TILED_VERSION = 1;
+
+Texture::Texture( )
+    : tileCache( nullptr ), tiledFile( -1 ), fileId( 0 ), tilesOffset( 0 ) {
+}
+
+Texture::Texture( string const &filename )
+    : Texture( ) {
+    unsigned w, h;
+    if ( lodepng::decode( texels, w, h, filename ) != 0 )
+        throw runtime_error( "Failed to read texture " + filename );
+    addLevel( w, h );
+    buildMipChain( );
+}
+
+shared_ptr< Texture > Texture::openTiled( string const &filename, TileCache &cache ) {
+    string tiledName = filename + ".rtt";
+    struct stat source, tiled;
+    bool hasSource = stat( filename.c_str( ), &source ) == 0;
+    bool upToDate = stat( tiledName.c_str( ), &tiled ) == 0 && ( !hasSource || tiled.st_mtime >= source.st_mtime );
+    shared_ptr< Texture > texture = upToDate ? readTiled( tiledName ) : nullptr;
+    // An invalid tiled file (e.g. of another version) is stale as well. It
+    // is rejected here, as a tile that fails to read while rendering is fatal
+    if ( !texture && ( hasSource || !upToDate ) ) {
+        Texture( filename ).writeTiled( tiledName );
+        texture = readTiled( tiledName );
+    }
+    if ( !texture )
+        throw runtime_error( "Invalid tiled texture " + tiledName );
+
+    texture->tileCache = &cache;
+    texture->fileId = TileCache::newFileId( );
+    return texture;
+}
+
+shared_ptr< Texture > Texture::readTiled( string const &tiledName ) {
+    int fd = open( tiledName.c_str( ), O_RDONLY );
+    if ( fd < 0 )
+        return nullptr;
+    shared_ptr< Texture > texture( new Texture( ) );
+    texture->tiledFile = fd; // Closed by the texture from here on
+
+    char magic[ 4 ];
+    uint32_t header[ 3 ];
+    struct stat info;
+    if ( fstat( fd, &info ) != 0 || pread( fd, magic, sizeof magic, 0 ) != sizeof magic ||
+         memcmp( magic, "RTTX", 4 ) != 0 || pread( fd, header, sizeof header, sizeof magic ) != sizeof header ||
+         header[ 0 ] != TILED_VERSION || header[ 1 ] != TileCache::TILE_SIZE )
+        return nullptr;
+
+    uint64_t fileBytes = info.st_size;
+    uint32_t numLevels = header[ 2 ];
+    uint64_t sizesOffset = sizeof magic + sizeof header;
+    if ( numLevels == 0 || sizesOffset + uint64_t( numLevels ) * 8 > fileBytes )
+        return nullptr;
+    vector< uint32_t > sizes( 2 * size_t( numLevels ) );
+    if ( pread( fd, sizes.data( ), sizes.size( ) * 4, sizesOffset ) != (ssize_t) ( sizes.size( ) * 4 ) )
+        return nullptr;
+    texture->tilesOffset = sizesOffset + sizes.size( ) * 4;
+
+    // All tiles must be in the file
+    uint64_t const tileSize = TileCache::TILE_SIZE;
+    uint64_t numTiles = 0;
+    for ( uint32_t i = 0; i < numLevels; i++ ) {
+        uint64_t width = sizes[ 2 * i ], height = sizes[ 2 * i + 1 ];
+        if ( width == 0 || height == 0 )
+            return nullptr;
+        numTiles += ( ( width + tileSize - 1 ) / tileSize ) * ( ( height + tileSize - 1 ) / tileSize );
+        if ( numTiles > ( fileBytes - texture->tilesOffset ) / TileCache::TILE_BYTES )
+            return nullptr;
+    }
+    for ( uint32_t i = 0; i < numLevels; i++ )
+        texture->addLevel( sizes[ 2 * i ], sizes[ 2 * i + 1 ] );
+    return texture;
+}
+
+Texture::~Texture( ) {
+    if ( tiledFile >= 0 )
+        close( tiledFile );
+}
+
+void Texture::swap( Texture &other ) {
+    std::swap( levels, other.levels );
+    std::swap( texels, other.texels );
+    std::swap( tileCache, other.tileCache );
+    std::swap( tiledFile, other.tiledFile );
+    std::swap( fileId, other.fileId );
+    std::swap( tilesOffset, other.tilesOffset );
+}
+
+unsigned Texture::width( ) const {
+    return levels[ 0 ].width;
+}
+
+unsigned Texture::height( ) const {
+    return levels[ 0 ].height;
+}
+
+unsigned Texture::numLevels( ) const {
+    return levels.size( );
+}
+
+bool Texture::isTiled( ) const {
+    return tileCache != nullptr;
+}
+
+size_t Texture::memoryBytes( ) const {
+    return texels.size( );
+}
+
+void Texture::writeTiled( string const &filename ) const {
+    // Written aside and renamed, so the file is never seen partially written,
+    // and textures that have the old file open keep reading it
+    string tempName = filename + ".tmp." + to_string( getpid( ) );
+    ofstream file( tempName, ios::binary );
+    uint32_t header[] = { TILED_VERSION, TileCache::TILE_SIZE, (uint32_t) levels.size( ) };
+    file.write( "RTTX", 4 );
+    file.write( (char const *) header, sizeof header );
+    for ( Level const &level : levels ) {
+        uint32_t size[] = { level.width, level.height };
+        file.write( (char const *) size, sizeof size );
+    }
+
+    unsigned const tileSize = TileCache::TILE_SIZE;
+    vector< uint8_t > tile( TileCache::TILE_BYTES );
+    for ( Level const &level : levels ) {
+        for ( unsigned y0 = 0; y0 < level.height; y0 += tileSize ) {
+            for ( unsigned x0 = 0; x0 < level.width; x0 += tileSize ) {
+                fill( tile.begin( ), tile.end( ), 0 );
+                unsigned rowBytes = min( tileSize, level.width - x0 ) * 4;
+                for ( unsigned y = y0; y < min( y0 + tileSize, level.height ); y++ ) {
+                    uint8_t const *src = &texels[ level.offset + ( (size_t) y * level.width + x0 ) * 4 ];
+                    copy( src, src + rowBytes, &tile[ ( y - y0 ) * tileSize * 4 ] );
+                }
+                file.write( (char const *) tile.data( ), tile.size( ) );
+            }
+        }
+    }
+    file.close( );
+    if ( file.fail( ) || rename( tempName.c_str( ), filename.c_str( ) ) != 0 ) {
+        unlink( tempName.c_str( ) );
+        throw runtime_error( "Failed to write tiled texture " + filename );
+    }
+}
+
+void Texture::addLevel( unsigned width, unsigned height ) {
+    unsigned const tileSize = TileCache::TILE_SIZE;
+    Level level{ width, height, 0, ( width + tileSize - 1 ) / tileSize, 0 };
+    if ( !levels.empty( ) ) {
+        Level const &prev = levels.back( );
+        level.offset = prev.offset + (size_t) prev.width * prev.height * 4;
+        level.firstTile = prev.firstTile + prev.tilesX * ( ( prev.height + tileSize - 1 ) / tileSize );
+    }
+    levels.push_back( level );
+}
+
+void Texture::buildMipChain( ) {
+    while ( levels.back( ).width > 1 || levels.back( ).height > 1 ) {
+        addLevel( max( levels.back( ).width / 2, 1u ), max( levels.back( ).height / 2, 1u ) );
+        Level const &src = levels[ levels.size( ) - 2 ];
+        Level const &dst = levels.back( );
+        texels.resize( dst.offset + (size_t) dst.width * dst.height * 4 );
+
+        for ( unsigned y = 0; y < dst.height; y++ ) {
+            unsigned y0 = min( 2 * y, src.height - 1 );
+            unsigned y1 = min( 2 * y + 1, src.height - 1 );
+            for ( unsigned x = 0; x < dst.width; x++ ) {
+                unsigned x0 = min( 2 * x, src.width - 1 );
+                unsigned x1 = min( 2 * x + 1, src.width - 1 );
+                uint8_t const *p00 = &texels[ src.offset + ( (size_t) y0 * src.width + x0 ) * 4 ];
+                uint8_t const *p01 = &texels[ src.offset + ( (size_t) y0 * src.width + x1 ) * 4 ];
+                uint8_t const *p10 = &texels[ src.offset + ( (size_t) y1 * src.width + x0 ) * 4 ];
+                uint8_t const *p11 = &texels[ src.offset + ( (size_t) y1 * src.width + x1 ) * 4 ];
+                uint8_t *out = &texels[ dst.offset + ( (size_t) y * dst.width + x ) * 4 ];
+                for ( int c = 0; c < 4; c++ )
+                    out[ c ] = (uint8_t) ( ( p00[ c ] + p01[ c ] + p10[ c ] + p11[ c ] + 2 ) / 4 );
+            }
+        }
+    }
+}
+
+Color Texture::texel( Level const &level, unsigned x, unsigned y ) const {
+    uint8_t const *p;
+    if ( tileCache ) {
+        unsigned const tileSize = TileCache::TILE_SIZE;
+        unsigned tile = level.firstTile + ( y / tileSize ) * level.tilesX + x / tileSize;
+        p = tileCache->fetch( TileCache::tileKey( fileId, tile ), tiledFile, tilesOffset + (uint64_t) tile * TileCache::TILE_BYTES );
+        p += ( ( y % tileSize ) * tileSize + x % tileSize ) * 4;
+    } else {
+        p = &texels[ level.offset + ( (size_t) y * level.width + x ) * 4 ];
+    }
+    return Color( p[ 0 ] / 255.0, p[ 1 ] / 255.0, p[ 2 ] / 255.0 );
+}
+
+Color Texture::bilinear( Level const &level, double u, double v ) const {
+    // Texel centers are at half-integer positions
+    double fx = u * level.width - 0.5;
+    double fy = min( max( v * level.height - 0.5, 0.0 ), level.height - 1.0 );
+    double floorX = floor( fx );
+    double floorY = floor( fy );
+    double tx = fx - floorX;
+    double ty = fy - floorY;
+
+    int w = level.width;
+    unsigned x0 = ( ( (int) floorX % w ) + w ) % w;
+    unsigned x1 = ( x0 + 1 ) % w;
+    unsigned y0 = (unsigned) floorY;
+    unsigned y1 = min( y0 + 1, level.height - 1 );
+
+    Color top = texel( level, x0, y0 ) * ( 1 - tx ) + texel( level, x1, y0 ) * tx;
+    Color bottom = texel( level, x0, y1 ) * ( 1 - tx ) + texel( level, x1, y1 ) * tx;
+    return top * ( 1 - ty ) + bottom * ty;
+}
+
+Color Texture::sample( double u, double v, double footprint, Filter filter ) const {
+    Level const &base = levels[ 0 ];
+    if ( filter == NEAREST ) {
+        // The lookup the textures always had (as Image::colorAt)
+        float x = (float) u;
+        float y = (float) v;
+        unsigned tx = min( static_cast< unsigned >( x * ( base.width - 1 ) ), base.width - 1 );
+        unsigned ty = min( static_cast< unsigned >( y * ( base.height - 1 ) ), base.height - 1 );
+        return texel( base, tx, ty );
+    }
+
+    // Level of detail: level i has texels of 2^i base texels wide
+    double lod = 0;
+    if ( filter == TRILINEAR && footprint > 0 )
+        lod = log2( footprint * max( base.width, base.height ) );
+    if ( lod <= 0 )
+        return bilinear( base, u, v );
+    if ( lod >= levels.size( ) - 1 )
+        return bilinear( levels.back( ), u, v );
+
+    unsigned level = (unsigned) lod;
+    double t = lod - level;
+    return bilinear( levels[ level ], u, v ) * ( 1 - t ) + bilinear( levels[ level + 1 ], u, v ) * t;
+}
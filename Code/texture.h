@@ -0,0 +1,96 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef TEXTURE_H_
+#define TEXTURE_H_
+
+#include "tilecache.h"
+#include "triple.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Read-only image for texturing, stored as 8-bit RGBA with a full mip chain.
+ *
+ * Every level halves the size of the previous one (rounded down, at least 1),
+ * down to a single texel. Each texel is the average of the (up to) 2x2 texels
+ * below it. Texture coordinates (u,v) are in [0,1]^2, with v = 0 at the top
+ * row. Filtered lookups wrap around in u (as the longitude of a sphere does)
+ * and clamp in v.
+ *
+ * The texels are either all in memory, or in a tiled file of which the tiles
+ * are paged in through a TileCache. A tiled file holds all levels, split in
+ * tiles of TileCache::TILE_SIZE^2 texels. It starts with the magic "RTTX" and
+ * the uint32 version, tile size and number of levels, followed by the uint32
+ * width and height of every level. Then the tiles follow, level by level, in
+ * scanline order. Tiles at the right and bottom edges are padded.
+ */
+class Texture
+{
+    public:
+        enum Filter
+        {
+            NEAREST,    // Nearest texel of the full-size level
+            BILINEAR,   // Bilinear interpolation of the full-size level
+            TRILINEAR   // Bilinear in the two levels matching the footprint, blended
+        };
+
+        // Reads a PNG file into memory
+        explicit Texture( std::string const &filename );
+        // Opens the tiled version of a PNG file ('filename' + ".rtt"), of which
+        // the tiles are read through 'cache'. The tiled file is written first
+        // if it does not exist, is older than the PNG file or is invalid
+        static std::shared_ptr< Texture > openTiled( std::string const &filename, TileCache &cache );
+
+        Texture( Texture const & ) = delete;
+        Texture &operator=( Texture const & ) = delete;
+        ~Texture( );
+
+        // Exchanges the texels, e.g. to tile a texture that is in use
+        void swap( Texture &other );
+
+        unsigned width( ) const;
+        unsigned height( ) const;
+        unsigned numLevels( ) const;
+        bool isTiled( ) const;
+        // Bytes taken by the texels of all levels (zero if tiled)
+        size_t memoryBytes( ) const;
+
+        // 'footprint' is the width of the area covered by the ray, in texture
+        // coordinates. It selects the mip level of trilinear filtering
+        Color sample( double u, double v, double footprint, Filter filter ) const;
+
+        // Writes the texture as a tiled file
+        void writeTiled( std::string const &filename ) const;
+
+    private:
+        struct Level
+        {
+            unsigned width;
+            unsigned height;
+            size_t offset;      // Of the first texel in 'texels'
+            unsigned tilesX;
+            unsigned firstTile; // Index of its first tile in the tiled file
+        };
+
+        std::vector< Level > levels;
+        // RGBA of all levels, each in scanline order. Empty if tiled
+        std::vector< uint8_t > texels;
+
+        TileCache *tileCache;
+        int tiledFile;
+        uint32_t fileId;
+        uint64_t tilesOffset; // Of the first tile in the tiled file
+
+        Texture( );
+        // Returns null if the tiled file cannot be opened or is invalid
+        static std::shared_ptr< Texture > readTiled( std::string const &tiledName );
+        void buildMipChain( );
+        void addLevel( unsigned width, unsigned height );
+        Color texel( Level const &level, unsigned x, unsigned y ) const;
+        Color bilinear( Level const &level, double u, double v ) const;
+};
+
+#endif
@@ -0,0 +1,69 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#include "textureregistry.h"
+
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <ostream>
+
+using namespace std;
+
+// Absolute path without symlinks, "." or "..". If the file does not exist
+// the path is kept, such that reading it reports the name as given
+static string canonicalPath( string const &filename ) {
+    char resolved[ PATH_MAX ];
+    if ( realpath( filename.c_str( ), resolved ) == nullptr )
+        return filename;
+    return resolved;
+}
+
+void TextureRegistry::setMemoryBudget( size_t budgetBytes ) {
+    tileCache.reset( new TileCache( budgetBytes ) );
+    // Textures loaded before are tiled as well. In place, as materials use them
+    for ( auto &entry : assets )
+        entry.second.texture->swap( *Texture::openTiled( entry.first, *tileCache ) );
+}
+
+shared_ptr< Texture > TextureRegistry::load( string const &filename ) {
+    string path = canonicalPath( filename );
+    auto it = assets.find( path );
+    if ( it != assets.end( ) ) {
+        it->second.uses++;
+        return it->second.texture;
+    }
+
+    auto start = chrono::steady_clock::now( );
+    shared_ptr< Texture > texture = tileCache ? Texture::openTiled( path, *tileCache )
+                                              : make_shared< Texture >( path );
+    auto end = chrono::steady_clock::now( );
+    double millis = chrono::duration< double, milli >( end - start ).count( );
+    assets[ path ] = Asset{ texture, millis, 1 };
+    return texture;
+}
+
+void TextureRegistry::printReport( ostream &os ) const {
+    if ( assets.empty( ) )
+        return;
+
+    size_t totalBytes = 0;
+    os << "Loaded " << assets.size( ) << " textures:\n";
+    for ( auto const &entry : assets ) {
+        Texture const &texture = *entry.second.texture;
+        totalBytes += texture.memoryBytes( );
+        os << "  " << entry.first << ": " << texture.width( ) << "x" << texture.height( )
+           << ", " << texture.numLevels( ) << " levels, ";
+        if ( texture.isTiled( ) )
+            os << "tiled, ";
+        else
+            os << ( texture.memoryBytes( ) / 1024 ) << " KiB, ";
+        os << entry.second.loadMillis << " ms, used by " << entry.second.uses << " materials\n";
+    }
+    if ( !tileCache )
+        os << "Texture memory: " << ( totalBytes / 1024 ) << " KiB\n";
+}
+
+void TextureRegistry::printCacheStats( ostream &os ) const {
+    if ( tileCache )
+        tileCache->printStats( os );
+}
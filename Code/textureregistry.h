@@ -0,0 +1,48 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef TEXTUREREGISTRY_H_
+#define TEXTUREREGISTRY_H_
+
+#include "texture.h"
+#include "tilecache.h"
+
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <string>
+
+/**
+ * The textures of a scene, each decoded once.
+ *
+ * Textures are keyed by their canonical path, so different spellings of the
+ * path of one file (relative, through symlinks, with "..") share a texture.
+ */
+class TextureRegistry
+{
+    public:
+        // Tile all textures, of which at most (about) 'budgetBytes' are in
+        // memory at any time. Those loaded before are tiled right away
+        void setMemoryBudget( size_t budgetBytes );
+
+        // Returns the texture of the file, reading it if it was not read before
+        std::shared_ptr< Texture > load( std::string const &filename );
+
+        // Lists every texture with its size, memory, load time and number of users
+        void printReport( std::ostream &os ) const;
+        // Paging statistics of tiled textures
+        void printCacheStats( std::ostream &os ) const;
+
+    private:
+        struct Asset
+        {
+            std::shared_ptr< Texture > texture;
+            double loadMillis;
+            unsigned uses;
+        };
+
+        std::map< std::string, Asset > assets;
+        // Only set if textures are tiled
+        std::unique_ptr< TileCache > tileCache;
+};
+
+#endif
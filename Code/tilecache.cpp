@@ -0,0 +1,87 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#include "tilecache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <ostream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+using namespace std;
+
+// Passed by reference, so they need a definition
+unsigned const TileCache::TILE_SIZE;
+size_t const TileCache::TILE_BYTES;
+
+TileCache::TileCache( size_t budgetBytes )
+    : budget( budgetBytes ), residentBytes( 0 ), peakBytes( 0 ), numLoads( 0 ), numEvictions( 0 ) {
+}
+
+uint32_t TileCache::newFileId( ) {
+    static atomic< uint32_t > nextId( 0 );
+    return nextId++;
+}
+
+uint64_t TileCache::tileKey( uint32_t fileId, uint32_t tile ) {
+    return ( (uint64_t) fileId << 32 ) | tile;
+}
+
+uint8_t const *TileCache::fetch( uint64_t key, int fd, uint64_t offset ) {
+    struct Slot
+    {
+        uint64_t key;
+        TilePtr tile;
+    };
+    thread_local Slot local[ LOCAL_SLOTS ] = { };
+
+    // Keys of neighbouring tiles differ in the low bits
+    Slot &slot = local[ ( key ^ ( key >> 32 ) ) % LOCAL_SLOTS ];
+    if ( slot.tile && slot.key == key )
+        return slot.tile->data( );
+
+    slot.tile = fetchShared( key, fd, offset );
+    slot.key = key;
+    return slot.tile->data( );
+}
+
+TileCache::TilePtr TileCache::fetchShared( uint64_t key, int fd, uint64_t offset ) {
+    {
+        lock_guard< std::mutex > lock( mutex );
+        auto it = tiles.find( key );
+        if ( it != tiles.end( ) ) {
+            lru.splice( lru.begin( ), lru, it->second.lruPos );
+            return it->second.tile;
+        }
+    }
+
+    // Read without holding the lock, so other threads are not held up by IO
+    auto texels = make_shared< vector< uint8_t > >( TILE_BYTES );
+    if ( pread( fd, texels->data( ), TILE_BYTES, offset ) != (ssize_t) TILE_BYTES )
+        throw runtime_error( "Failed to read texture tile" );
+
+    lock_guard< std::mutex > lock( mutex );
+    auto it = tiles.find( key );
+    if ( it != tiles.end( ) ) // Another thread read it meanwhile
+        return it->second.tile;
+
+    lru.push_front( key );
+    tiles[ key ] = Entry{ texels, lru.begin( ) };
+    residentBytes += TILE_BYTES;
+    numLoads++;
+    while ( residentBytes > budget && lru.size( ) > 1 ) {
+        tiles.erase( lru.back( ) );
+        lru.pop_back( );
+        residentBytes -= TILE_BYTES;
+        numEvictions++;
+    }
+    peakBytes = max( peakBytes, residentBytes );
+    return texels;
+}
+
+void TileCache::printStats( ostream &os ) const {
+    lock_guard< std::mutex > lock( mutex );
+    os << "Texture tiles: " << numLoads << " loaded, " << numEvictions << " evicted, peak "
+       << ( peakBytes / 1024 ) << " KiB of " << ( budget / 1024 ) << " KiB budget\n";
+}
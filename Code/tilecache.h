@@ -0,0 +1,70 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef TILECACHE_H_
+#define TILECACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Texture tiles paged in from disk on demand, within a memory budget.
+ *
+ * Tiles are fixed-size blocks of a file, identified by a key that is unique
+ * over all files (see newFileId). When the resident tiles exceed the budget,
+ * the least recently used ones are evicted.
+ *
+ * Every thread first looks in a small cache of its own, which needs no lock.
+ * Only its misses take the global lock and count as uses for the LRU order.
+ * The per-thread caches keep their tiles alive after eviction, so memory may
+ * exceed the budget by at most LOCAL_SLOTS tiles per thread.
+ */
+class TileCache
+{
+    public:
+        // Width and height of a tile in texels (of 4 bytes)
+        static unsigned const TILE_SIZE = 64;
+        static size_t const TILE_BYTES = TILE_SIZE * TILE_SIZE * 4;
+
+        explicit TileCache( size_t budgetBytes );
+
+        // A new id for a file, to build tile keys with
+        static uint32_t newFileId( );
+        static uint64_t tileKey( uint32_t fileId, uint32_t tile );
+
+        // Texels of the tile with the given key. If it is not resident, it is
+        // read from 'offset' in the file descriptor 'fd'. The pointer remains
+        // valid until the next fetch by the same thread
+        uint8_t const *fetch( uint64_t key, int fd, uint64_t offset );
+
+        void printStats( std::ostream &os ) const;
+
+    private:
+        static unsigned const LOCAL_SLOTS = 64;
+
+        typedef std::shared_ptr< std::vector< uint8_t > const > TilePtr;
+        struct Entry
+        {
+            TilePtr tile;
+            std::list< uint64_t >::iterator lruPos;
+        };
+
+        size_t budget;
+        mutable std::mutex mutex;
+        std::unordered_map< uint64_t, Entry > tiles;
+        // Keys of resident tiles, most recently used first
+        std::list< uint64_t > lru;
+        size_t residentBytes;
+        size_t peakBytes;
+        unsigned long numLoads;
+        unsigned long numEvictions;
+
+        TilePtr fetchShared( uint64_t key, int fd, uint64_t offset );
+};
+
+#endif
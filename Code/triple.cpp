@@ -11,13 +11,6 @@ using json = nlohmann::json;
 
 // --- Constructors ------------------------------------------------------------
 
-Triple::Triple(double X, double Y, double Z)
-:
-    x(X),
-    y(Y),
-    z(Z)
-{}
-
 Triple::Triple(json const &node)
 {
     if (!node.is_array())
@@ -75,6 +68,16 @@ Triple Triple::operator/(double f) const
     return Triple(x * invf, y * invf, z * invf);
 }
 
+bool Triple::operator==(Triple const &t) const
+{
+    return x == t.x && y == t.y && z == t.z;
+}
+
+bool Triple::operator!=(Triple const &t) const
+{
+    return !( *this == t );
+}
+
 // --- Compound operators ------------------------------------------------------
 
 Triple &Triple::operator+=(Triple const &t)
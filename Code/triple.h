@@ -37,7 +37,12 @@ class Triple
 
 // --- Constructors ------------------------------------------------------------
 
-        explicit Triple(double X = 0, double Y = 0, double Z = 0);
+        explicit Triple(double X = 0, double Y = 0, double Z = 0)
+        :
+            x(X),
+            y(Y),
+            z(Z)
+        {}
         explicit Triple(nlohmann::json const &node);    // json -> Triple
 
 // --- Operators ---------------------------------------------------------------
@@ -55,6 +60,9 @@ class Triple
                                                 // value
         Triple operator/(double f) const;       // divide each member by a value
 
+        bool operator==(Triple const &t) const; // memberwise equality
+        bool operator!=(Triple const &t) const;
+
 // --- Compound operators ------------------------------------------------------
 
         Triple &operator+=(Triple const &t);
@@ -0,0 +1,236 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#include "wavefront.h"
+
+#include "material.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// Spreads the lower 10 bits of 'v' such that there are 2 zero bits between
+// each of them
+static uint32_t spreadBits( uint32_t v ) {
+    v &= 0x3ff;
+    v = ( v | ( v << 16 ) ) & 0x030000ff;
+    v = ( v | ( v <<  8 ) ) & 0x0300f00f;
+    v = ( v | ( v <<  4 ) ) & 0x030c30c3;
+    v = ( v | ( v <<  2 ) ) & 0x09249249;
+    return v;
+}
+
+// Interleaves three 10-bit cell coordinates into a 30-bit Morton code
+static uint32_t morton3( uint32_t x, uint32_t y, uint32_t z ) {
+    return ( spreadBits( x ) << 2 ) | ( spreadBits( y ) << 1 ) | spreadBits( z );
+}
+
+// Index (0-7) of the octant the direction points into
+static uint32_t octant( Vector const &D ) {
+    return ( D.x < 0 ? 4 : 0 ) | ( D.y < 0 ? 2 : 0 ) | ( D.z < 0 ? 1 : 0 );
+}
+
+// Maps 'v' within [low,low+extent] to a cell in [0,1023]
+static uint32_t cell( double v, double low, double extent ) {
+    if ( extent <= 0 )
+        return 0;
+    return (uint32_t) min( 1023.0, max( 0.0, ( v - low ) / extent * 1023.0 ) );
+}
+
+Wavefront::Wavefront( Scene &scene )
+    : scene( scene ) {
+    for ( Material const &material : scene.materials ) {
+        bool t = material.hasTexture;
+        PathKernel kernel = nullptr;
+        switch ( scene.shadingClass( material ) ) {
+        case SHADE_FLAT:
+            kernel = t ? &Wavefront::shadeFlat< true > : &Wavefront::shadeFlat< false >;
+            break;
+        case SHADE_DIFFUSE:
+            kernel = t ? &Wavefront::shadePhong< false, false, true > : &Wavefront::shadePhong< false, false, false >;
+            break;
+        case SHADE_PHONG:
+            kernel = t ? &Wavefront::shadePhong< true, false, true > : &Wavefront::shadePhong< true, false, false >;
+            break;
+        case SHADE_REFLECTIVE:
+            kernel = t ? &Wavefront::shadePhong< true, true, true > : &Wavefront::shadePhong< true, true, false >;
+            break;
+        }
+        pathKernels.push_back( kernel );
+    }
+}
+
+void Wavefront::render( FrameBuffer &frameBuffer ) {
+    int numTiles = frameBuffer.numTiles( );
+
+    #pragma omp parallel
+    {
+        TileState state;
+
+        #pragma omp for schedule(dynamic)
+        for ( int tile = 0; tile < numTiles; tile++ ) {
+            renderTile( frameBuffer, state, tile );
+        }
+    }
+}
+
+void Wavefront::renderTile( FrameBuffer &frameBuffer, TileState &state, unsigned index ) {
+    FrameBuffer::TileBuffer &tile = state.tile;
+    frameBuffer.beginTile( index, tile );
+    unsigned h = frameBuffer.height( );
+    unsigned x0 = tile.x0( ), y0 = tile.y0( );
+    unsigned x1 = tile.x1( ), y1 = tile.y1( );
+    unsigned ssFactor = max( scene.superSamplingFactor, 1u );
+    unsigned samplesPerPixel = ssFactor * ssFactor;
+
+    // Generate all camera rays of the tile. Samples are stored per pixel, in
+    // scanline order within the tile
+    state.paths.clear( );
+    for ( unsigned y = y0; y < y1; y++ ) {
+        for ( unsigned x = x0; x < x1; x++ ) {
+            for ( unsigned ssY = 0; ssY < ssFactor; ssY++ ) {
+                for ( unsigned ssX = 0; ssX < ssFactor; ssX++ ) {
+                    unsigned sample = (unsigned) state.paths.size( );
+                    state.paths.push_back( PathRay{ scene.cameraRay( x, y, ssX, ssY, h ), sample, 1.0 } );
+                }
+            }
+        }
+    }
+    state.samples.assign( state.paths.size( ), Color( ) );
+
+    // Every iteration is one "bounce"
+    for ( int recDepth = scene.maxRecursionDepth; recDepth >= 0 && !state.paths.empty( ); recDepth-- ) {
+        if ( recDepth != (int) scene.maxRecursionDepth && scene.sortSecondaryRays )
+            sortPaths( state ); // Camera rays are coherent already
+        intersectPaths( state );
+        shadePaths( state, recDepth );
+        traceShadows( state );
+        swap( state.paths, state.nextPaths );
+    }
+
+    // Resolve the samples into pixels
+    unsigned sample = 0;
+    for ( unsigned y = y0; y < y1; y++ ) {
+        for ( unsigned x = x0; x < x1; x++ ) {
+            for ( unsigned i = 0; i < samplesPerPixel; i++, sample++ ) {
+                Color col = state.samples[ sample ];
+                if ( scene.clampSamples )
+                    col.clamp( );
+                tile.add( x, y, col );
+            }
+        }
+    }
+    frameBuffer.commit( tile );
+}
+
+void Wavefront::sortPaths( TileState &state ) {
+    vector< PathRay > &paths = state.paths;
+    if ( paths.size( ) < 2 )
+        return;
+
+    // Bounds of the ray origins. The Morton grid is fitted to these
+    Point low = paths[ 0 ].ray.O;
+    Point upp = paths[ 0 ].ray.O;
+    for ( PathRay const &path : paths ) {
+        for ( int i = 0; i < 3; i++ ) {
+            low.data[ i ] = min( low.data[ i ], path.ray.O.data[ i ] );
+            upp.data[ i ] = max( upp.data[ i ], path.ray.O.data[ i ] );
+        }
+    }
+    Vector extent = upp - low;
+
+    state.sortKeys.clear( );
+    for ( unsigned i = 0; i < paths.size( ); i++ ) {
+        Point const &O = paths[ i ].ray.O;
+        uint32_t code = morton3( cell( O.x, low.x, extent.x ), cell( O.y, low.y, extent.y ), cell( O.z, low.z, extent.z ) );
+        uint64_t key = ( (uint64_t) octant( paths[ i ].ray.D ) << 30 ) | code;
+        state.sortKeys.push_back( make_pair( key, i ) );
+    }
+    sort( state.sortKeys.begin( ), state.sortKeys.end( ) );
+
+    state.nextPaths.clear( );
+    for ( auto const &key : state.sortKeys )
+        state.nextPaths.push_back( paths[ key.second ] );
+    swap( state.paths, state.nextPaths );
+}
+
+void Wavefront::intersectPaths( TileState &state ) {
+    size_t numPaths = state.paths.size( );
+    state.hits.assign( numPaths, Hit::NO_HIT( ) );
+    state.hitObjs.assign( numPaths, nullptr );
+
+    for ( size_t i = 0; i < numPaths; i++ ) {
+        if ( !scene.hit( state.paths[ i ].ray, state.hits[ i ], state.hitObjs[ i ] ) )
+            state.hitObjs[ i ] = nullptr;
+    }
+}
+
+void Wavefront::shadePaths( TileState &state, int recDepth ) {
+    state.shadows.clear( );
+    state.nextPaths.clear( );
+
+    for ( size_t i = 0; i < state.paths.size( ); i++ ) {
+        Object *obj = state.hitObjs[ i ];
+        if ( obj ) // No hit? The background is black
+            ( this->*pathKernels[ obj->material ] )( state, i, recDepth );
+    }
+}
+
+// Flat materials have no shading
+template < bool HasTexture >
+void Wavefront::shadeFlat( TileState &state, size_t i, int recDepth ) {
+    PathRay const &path = state.paths[ i ];
+    state.samples[ path.sample ] += path.weight * scene.surfaceColor< HasTexture >( *state.hitObjs[ i ], path.ray, state.hits[ i ] );
+}
+
+template < bool HasSpecular, bool IsReflective, bool HasTexture >
+void Wavefront::shadePhong( TileState &state, size_t i, int recDepth ) {
+    PathRay const &path = state.paths[ i ];
+    Object &obj = *state.hitObjs[ i ];
+    Material const &material = scene.materials[ obj.material ];
+    Point hitPoint = path.ray.at( state.hits[ i ].t );
+    Vector N = state.hits[ i ].N;
+    Vector V = -path.ray.D;
+    Color materialColor = scene.surfaceColor< HasTexture >( obj, path.ray, state.hits[ i ] );
+    Color &sample = state.samples[ path.sample ];
+
+    sample += path.weight * ( scene.ambientTerm( material ) * materialColor );
+
+    scene.gatherLights( hitPoint, material, state.lightSamples );
+    for ( LightSample const &lightSample : state.lightSamples ) {
+        Light const &light = *scene.lights[ lightSample.index ];
+        Color diffuseColor, specularColor;
+        if ( light.isArea( ) ) {
+            // Area lights decide how many shadow rays they need from the
+            // outcome of the first ones. So these are traced right away
+            if ( scene.hasShadows )
+                scene.areaLightTerms< true, HasSpecular >( lightSample, light.color, obj.material, hitPoint, N, V, diffuseColor, specularColor );
+            else
+                scene.areaLightTerms< false, HasSpecular >( lightSample, light.color, obj.material, hitPoint, N, V, diffuseColor, specularColor );
+            sample += path.weight * ( diffuseColor * materialColor + specularColor );
+            continue;
+        }
+
+        Vector L = ( light.position - hitPoint ).normalized( );
+        scene.lightTerms< HasSpecular >( light.color * lightSample.scale, obj.material, N, L, V, diffuseColor, specularColor );
+        Color contribution = path.weight * ( diffuseColor * materialColor + specularColor );
+
+        if ( scene.hasShadows ) {
+            float lightDistance = ( light.position - hitPoint ).length( );
+            state.shadows.push_back( ShadowRay{ scene.shadowRay( hitPoint, L ), lightDistance, lightSample.index, path.sample, contribution } );
+        } else {
+            sample += contribution;
+        }
+    }
+
+    double scale;
+    if ( IsReflective && recDepth > 0 && scene.keepRay( path.weight * material.ks, scale ) ) {
+        state.nextPaths.push_back( PathRay{ scene.reflectionRay( hitPoint, N, V ), path.sample, path.weight * ( material.ks * scale ) } );
+    }
+}
+
+void Wavefront::traceShadows( TileState &state ) {
+    for ( ShadowRay const &shadow : state.shadows ) {
+        if ( !scene.occluded( shadow.ray, shadow.maxT, shadow.light ) )
+            state.samples[ shadow.sample ] += shadow.contribution;
+    }
+}
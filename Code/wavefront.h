@@ -0,0 +1,103 @@
+/* Authors: Dennis G. Sprokholt (s2983842), Luigi Gao (s2915375) */
+
+#ifndef WAVEFRONT_H_
+#define WAVEFRONT_H_
+
+#include "framebuffer.h"
+#include "hit.h"
+#include "object.h"
+#include "ray.h"
+#include "scene.h"
+#include "triple.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * Iterative alternative to the recursive Scene::trace.
+ *
+ * The image is split into tiles. All primary rays of a tile are put in a queue
+ * that is intersected in bulk. A separate shading pass then turns the hits into
+ * a queue of shadow rays and a queue of reflection rays. The shadow rays are
+ * intersected in bulk as well, after which the reflection queue becomes the
+ * next wave. This repeats until the recursion depth is exhausted.
+ *
+ * Reflection rays scatter in all directions. So, before they are intersected,
+ * they are sorted by direction octant and by the Morton code of their origin.
+ * As every ray knows its sample, shading is unaffected by this order.
+ *
+ * All radiance is linear in the weights of the rays, so every ray simply adds
+ * its (weighted) contribution to the sample it originated from. The result is
+ * the same image as produced by the recursive tracer.
+ */
+class Wavefront
+{
+    public:
+        explicit Wavefront( Scene &scene );
+
+        // Renders into 'frameBuffer' tile by tile, with the tiles of the frame buffer
+        void render( FrameBuffer &frameBuffer );
+
+    private:
+        // A camera or reflection ray, of which the radiance is added to
+        // 'sample' after scaling it by 'weight'
+        struct PathRay
+        {
+            Ray ray;
+            unsigned sample;
+            double weight;
+        };
+
+        // A ray towards light 'light'. If nothing blocks it before 'maxT', then
+        // 'contribution' is added to 'sample'
+        struct ShadowRay
+        {
+            Ray ray;
+            float maxT;
+            unsigned light;
+            unsigned sample;
+            Color contribution;
+        };
+
+        // The queues and buffers of a single tile. Kept per thread, so they
+        // are allocated only once
+        struct TileState
+        {
+            FrameBuffer::TileBuffer tile;
+            std::vector< Color > samples;
+            std::vector< PathRay > paths;
+            std::vector< PathRay > nextPaths;
+            std::vector< Hit > hits;
+            std::vector< Object* > hitObjs;
+            std::vector< ShadowRay > shadows;
+            std::vector< LightSample > lightSamples;
+            // (key, index into 'paths') pairs used for sorting
+            std::vector< std::pair< uint64_t, unsigned > > sortKeys;
+        };
+
+        Scene &scene;
+
+        void renderTile( FrameBuffer &frameBuffer, TileState &state, unsigned index );
+
+        // Reorders 'state.paths' by direction octant and origin Morton code.
+        // Uses 'state.nextPaths' as scratch space
+        void sortPaths( TileState &state );
+        // Intersects all rays in 'state.paths'. Results go in 'state.hits' and 'state.hitObjs'
+        void intersectPaths( TileState &state );
+        // Shades all hits. Fills the shadow queue and the reflection queue
+        void shadePaths( TileState &state, int recDepth );
+
+        // Shades the hit of path 'i'. Specialized per material, like the kernels of Scene
+        typedef void (Wavefront::*PathKernel)( TileState &state, size_t i, int recDepth );
+        std::vector< PathKernel > pathKernels;
+
+        template < bool HasTexture >
+        void shadeFlat( TileState &state, size_t i, int recDepth );
+        template < bool HasSpecular, bool IsReflective, bool HasTexture >
+        void shadePhong( TileState &state, size_t i, int recDepth );
+        // Intersects all shadow rays and adds the contributions of the unoccluded ones
+        void traceShadows( TileState &state );
+};
+
+#endif